@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * One run of the end-to-end benchmark, normally started by run-bench.sh with
+ * the stand-in services on the bus.  It shows a BishoFrame and times:
+ *
+ * - the first paint of the window;
+ * - every service header being built;
+ * - every pane, all opened at once, having checked its login state;
+ * - logging in to one OAuth service and back out, repeatedly, clicking the
+ *   buttons as a user would.
+ *
+ * Times are in milliseconds from --exec-time, or from the start of main() if
+ * it isn't given, and are printed as a single JSON object.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include "bisho-frame.h"
+#include "bisho-module.h"
+#include "bisho-pane.h"
+#include "mux-expanding-item.h"
+
+static gint64 opt_exec_time = 0;
+static int opt_logins = 5;
+static char *opt_login_service = NULL;
+static char *opt_verifier = NULL;
+static int opt_timeout = 120;
+static char *opt_module_dir = NULL;
+
+static const GOptionEntry options[] = {
+  { "exec-time", 0, 0, G_OPTION_ARG_INT64, &opt_exec_time,
+    "Measure from USEC, the wall clock time the process was started", "USEC" },
+  { "logins", 'n', 0, G_OPTION_ARG_INT, &opt_logins,
+    "Log in and out N times", "N" },
+  { "login-service", 's', 0, G_OPTION_ARG_STRING, &opt_login_service,
+    "Log in to SERVICE (by default stub0)", "SERVICE" },
+  { "verifier", 0, 0, G_OPTION_ARG_STRING, &opt_verifier,
+    "Continue 1.0a logins with VERIFIER", "VERIFIER" },
+  { "timeout", 't', 0, G_OPTION_ARG_INT, &opt_timeout,
+    "Give up after SECONDS", "SECONDS" },
+  { "module-dir", 0, 0, G_OPTION_ARG_FILENAME, &opt_module_dir,
+    "Load the panes in DIR, when bisho isn't installed", "DIR" },
+  { NULL }
+};
+
+typedef enum {
+  WAIT_HEADERS,
+  WAIT_PANES,
+  LOGGING_OUT,
+  LOGGING_IN,
+  DONE
+} Stage;
+
+static Stage stage = WAIT_HEADERS;
+static gboolean timed_out = FALSE;
+static GtkWidget *frame;
+static gint64 start_time;
+static gint64 first_paint = -1;
+static gint64 headers_ready = -1;
+static gint64 panes_ready = -1;
+static guint n_panes = 0;
+
+/* The pane being logged in to, and its button */
+static BishoPane *login_pane;
+static GtkWidget *login_button;
+static gint64 login_start;
+static GArray *logins;
+static int login_failures = 0;
+
+typedef struct {
+  GType type;
+  GList *found;
+} Search;
+
+static void
+search_cb (GtkWidget *widget, gpointer user_data)
+{
+  Search *search = user_data;
+
+  if (G_TYPE_CHECK_INSTANCE_TYPE (widget, search->type))
+    search->found = g_list_prepend (search->found, widget);
+
+  if (GTK_IS_CONTAINER (widget))
+    gtk_container_forall (GTK_CONTAINER (widget), search_cb, search);
+}
+
+/* Returns every widget of @type under @root, including internal children */
+static GList *
+find_widgets (GtkWidget *root, GType type)
+{
+  Search search = { type, NULL };
+
+  search_cb (root, &search);
+
+  return g_list_reverse (search.found);
+}
+
+static double
+to_ms (gint64 t)
+{
+  return t < 0 ? -1.0 : (t - start_time) / 1000.0;
+}
+
+static void
+finish (void)
+{
+  guint i;
+
+  stage = DONE;
+
+  g_print ("{ \"panes\": %u, \"first_paint_ms\": %.1f, \"headers_ready_ms\": %.1f, "
+           "\"panes_ready_ms\": %.1f, \"login_ms\": [",
+           n_panes, to_ms (first_paint), to_ms (headers_ready), to_ms (panes_ready));
+  for (i = 0; i < logins->len; i++)
+    g_print ("%s%.1f", i ? ", " : "", g_array_index (logins, double, i));
+  g_print ("], \"login_failures\": %d, \"timed_out\": %s }\n",
+           login_failures, timed_out ? "true" : "false");
+
+  gtk_main_quit ();
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  if (stage != DONE) {
+    timed_out = TRUE;
+    finish ();
+  }
+
+  return FALSE;
+}
+
+static const char *
+get_label (void)
+{
+  return gtk_button_get_label (GTK_BUTTON (login_button)) ?: "";
+}
+
+static gboolean
+click_idle (gpointer user_data)
+{
+  gtk_button_clicked (GTK_BUTTON (login_button));
+
+  return FALSE;
+}
+
+static void
+click (void)
+{
+  /* Clicked from an idle so that the pane has finished updating first */
+  g_idle_add (click_idle, NULL);
+}
+
+/* Log in again, or stop if that was the last one */
+static void
+next_login (void)
+{
+  if ((int)logins->len + login_failures >= opt_logins) {
+    finish ();
+    return;
+  }
+
+  stage = LOGGING_IN;
+  login_start = g_get_real_time ();
+  click ();
+}
+
+static void
+continue_auth (void)
+{
+  GHashTable *params;
+  GList *entries;
+
+  params = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* 1.0a with a redirect gets the verifier as a parameter, and with oob it is
+     typed in */
+  if (opt_verifier) {
+    g_hash_table_insert (params, "oauth_verifier", opt_verifier);
+
+    entries = find_widgets (login_pane->content, GTK_TYPE_ENTRY);
+    if (entries)
+      gtk_entry_set_text (GTK_ENTRY (entries->data), opt_verifier);
+    g_list_free (entries);
+  }
+
+  bisho_pane_continue_auth (login_pane, params);
+  g_hash_table_destroy (params);
+}
+
+static void
+label_changed_cb (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+  const char *label = get_label ();
+
+  switch (stage) {
+  case LOGGING_OUT:
+    if (strcmp (label, "Log me in") == 0)
+      next_login ();
+    break;
+  case LOGGING_IN:
+    if (strcmp (label, "Continue") == 0) {
+      continue_auth ();
+    } else if (strcmp (label, "Log me out") == 0) {
+      double ms = (g_get_real_time () - login_start) / 1000.0;
+
+      g_array_append_val (logins, ms);
+      stage = LOGGING_OUT;
+      click ();
+    } else if (strcmp (label, "Log me in") == 0) {
+      login_failures++;
+      next_login ();
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void
+start_logins (void)
+{
+  GList *panes, *l, *buttons;
+  const char *name = opt_login_service ?: "stub0";
+
+  panes = find_widgets (frame, BISHO_TYPE_PANE);
+  for (l = panes; l; l = l->next) {
+    if (strcmp (BISHO_PANE (l->data)->info->name, name) == 0)
+      login_pane = l->data;
+  }
+  g_list_free (panes);
+
+  if (login_pane == NULL || opt_logins <= 0) {
+    finish ();
+    return;
+  }
+
+  buttons = find_widgets (login_pane->content, GTK_TYPE_BUTTON);
+  if (buttons == NULL) {
+    g_printerr ("No button in the %s pane\n", name);
+    finish ();
+    return;
+  }
+  login_button = buttons->data;
+  g_list_free (buttons);
+
+  g_signal_connect (login_button, "notify::label", G_CALLBACK (label_changed_cb), NULL);
+
+  /* Start logged out, so that every login is timed from the same state */
+  if (strcmp (get_label (), "Log me out") == 0) {
+    stage = LOGGING_OUT;
+    click ();
+  } else {
+    next_login ();
+  }
+}
+
+/* Construct every pane, as expanding every header or selecting every row would */
+static void
+open_all_panes (void)
+{
+  GList *items, *views, *l;
+
+  items = find_widgets (frame, MUX_TYPE_EXPANDING_ITEM);
+  for (l = items; l; l = l->next)
+    mux_expanding_item_set_active (MUX_EXPANDING_ITEM (l->data), TRUE);
+  g_list_free (items);
+
+  views = find_widgets (frame, GTK_TYPE_TREE_VIEW);
+  for (l = views; l; l = l->next) {
+    GtkTreeView *view = l->data;
+    GtkTreeModel *model = gtk_tree_view_get_model (view);
+    GtkTreeIter iter;
+
+    if (model && gtk_tree_model_get_iter_first (model, &iter)) {
+      do {
+        gtk_tree_selection_select_iter (gtk_tree_view_get_selection (view), &iter);
+      } while (gtk_tree_model_iter_next (model, &iter));
+    }
+  }
+  g_list_free (views);
+}
+
+static gboolean
+all_panes_ready (void)
+{
+  GList *panes, *l;
+  gboolean ready = TRUE;
+
+  panes = find_widgets (frame, BISHO_TYPE_PANE);
+  n_panes = g_list_length (panes);
+  for (l = panes; l; l = l->next)
+    ready &= bisho_pane_is_ready (l->data);
+  g_list_free (panes);
+
+  return ready;
+}
+
+static void
+frame_ready_cb (BishoFrame *_frame, gpointer user_data)
+{
+  switch (stage) {
+  case WAIT_HEADERS:
+    headers_ready = g_get_real_time ();
+    stage = WAIT_PANES;
+    open_all_panes ();
+    /* Panes that were ready as soon as they were built don't make the frame
+       emit "ready" again */
+    if (!all_panes_ready ())
+      break;
+    /* Fall through */
+  case WAIT_PANES:
+    panes_ready = g_get_real_time ();
+    all_panes_ready ();
+    start_logins ();
+    break;
+  default:
+    break;
+  }
+}
+
+static gboolean
+first_expose_cb (GtkWidget *widget, GdkEventExpose *event, gpointer user_data)
+{
+  if (first_paint < 0)
+    first_paint = g_get_real_time ();
+
+  return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GtkWidget *window;
+
+  start_time = g_get_real_time ();
+
+  g_thread_init (NULL);
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_exec_time > 0)
+    start_time = opt_exec_time;
+
+  if (opt_module_dir)
+    bisho_module_scan (opt_module_dir);
+
+  logins = g_array_new (FALSE, FALSE, sizeof (double));
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_default_size (GTK_WINDOW (window), 1024, 768);
+  g_signal_connect_after (window, "expose-event", G_CALLBACK (first_expose_cb), NULL);
+
+  frame = bisho_frame_new ();
+  g_signal_connect (frame, "ready", G_CALLBACK (frame_ready_cb), NULL);
+  bisho_frame_populate (BISHO_FRAME (frame));
+  gtk_widget_show (frame);
+  gtk_container_add (GTK_CONTAINER (window), frame);
+
+  gtk_widget_show (window);
+
+  g_timeout_add_seconds (opt_timeout, timeout_cb, NULL);
+
+  gtk_main ();
+
+  return timed_out ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Stresses the exclusive expander groups: several groups, as several frames
+ * would have, are filled with more and more expanders, which are then opened
+ * at random and destroyed.  If expanding and destroying are independent of the
+ * number of expanders the times per operation stay flat as it grows.  The
+ * results are printed as JSON, in microseconds per operation.
+ */
+
+#include <config.h>
+#include <gtk/gtk.h>
+#include "bisho-utils.h"
+#include "mux-expanding-item.h"
+
+static int opt_frames = 4;
+static int opt_items = 5000;
+static int opt_toggles = 100000;
+
+static const GOptionEntry options[] = {
+  { "frames", 'f', 0, G_OPTION_ARG_INT, &opt_frames,
+    "Use N expander groups", "N" },
+  { "items", 'n', 0, G_OPTION_ARG_INT, &opt_items,
+    "Grow each group to N expanders", "N" },
+  { "toggles", 't', 0, G_OPTION_ARG_INT, &opt_toggles,
+    "Open an expander N times for each size", "N" },
+  { NULL }
+};
+
+typedef struct {
+  double toggle_us;
+  double destroy_us;
+  gboolean exclusive;
+} Result;
+
+/* Whether at most one expander in @items is open */
+static gboolean
+is_exclusive (GPtrArray *items)
+{
+  guint i, open = 0;
+
+  for (i = 0; i < items->len; i++)
+    open += mux_expanding_item_get_active (g_ptr_array_index (items, i));
+
+  return open <= 1;
+}
+
+static void
+run (int n_items, Result *result)
+{
+  BishoExpanderGroup **groups;
+  GPtrArray **items;
+  GTimer *timer;
+  GRand *rand;
+  GtkWidget *item;
+  int f, i;
+
+  groups = g_new (BishoExpanderGroup *, opt_frames);
+  items = g_new (GPtrArray *, opt_frames);
+
+  for (f = 0; f < opt_frames; f++) {
+    groups[f] = bisho_expander_group_new ();
+    items[f] = g_ptr_array_sized_new (n_items);
+
+    for (i = 0; i < n_items; i++) {
+      item = mux_expanding_item_new ();
+      g_object_ref_sink (item);
+      bisho_expander_group_add (groups[f], MUX_EXPANDING_ITEM (item));
+      g_ptr_array_add (items[f], item);
+    }
+  }
+
+  /* The same sequence for every size, so that only the size changes */
+  rand = g_rand_new_with_seed (42);
+
+  timer = g_timer_new ();
+  for (i = 0; i < opt_toggles; i++) {
+    f = g_rand_int_range (rand, 0, opt_frames);
+    item = g_ptr_array_index (items[f], g_rand_int_range (rand, 0, n_items));
+    mux_expanding_item_set_active (MUX_EXPANDING_ITEM (item), TRUE);
+  }
+  result->toggle_us = g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC / opt_toggles;
+
+  result->exclusive = TRUE;
+  for (f = 0; f < opt_frames; f++)
+    result->exclusive &= is_exclusive (items[f]);
+
+  /* Destroy in creation order, so that the open expander goes at a random
+     point rather than always first or last */
+  g_timer_start (timer);
+  for (f = 0; f < opt_frames; f++) {
+    for (i = 0; i < n_items; i++) {
+      item = g_ptr_array_index (items[f], i);
+      gtk_widget_destroy (item);
+      g_object_unref (item);
+    }
+  }
+  result->destroy_us = g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC / (opt_frames * n_items);
+
+  for (f = 0; f < opt_frames; f++) {
+    bisho_expander_group_free (groups[f]);
+    g_ptr_array_free (items[f], TRUE);
+  }
+
+  g_timer_destroy (timer);
+  g_rand_free (rand);
+  g_free (items);
+  g_free (groups);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  Result result;
+  int n_items;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (FALSE));
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_frames <= 0 || opt_items <= 0 || opt_toggles <= 0) {
+    g_printerr ("The number of frames, items and toggles must be positive\n");
+    return 1;
+  }
+
+  if (!gtk_init_check (&argc, &argv)) {
+    g_printerr ("Cannot open the display\n");
+    return 1;
+  }
+
+  g_print ("{\n  \"benchmark\": \"expander-group\",\n  \"frames\": %d,\n  \"toggles\": %d,\n"
+           "  \"results\": [\n",
+           opt_frames, opt_toggles);
+
+  /* Ten expanders and every power of ten up to the full size */
+  n_items = MIN (10, opt_items);
+  for (;;) {
+    run (n_items, &result);
+
+    g_print ("    { \"items\": %d, \"toggle_us\": %.3f, \"destroy_us\": %.3f, \"exclusive\": %s }%s\n",
+             n_items, result.toggle_us, result.destroy_us,
+             result.exclusive ? "true" : "false",
+             n_items < opt_items ? "," : "");
+
+    if (n_items == opt_items)
+      break;
+    n_items = MIN (n_items * 10, opt_items);
+  }
+
+  g_print ("  ]\n}\n");
+
+  return 0;
+}
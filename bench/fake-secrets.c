@@ -0,0 +1,738 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * An in-memory secret store on the session bus, with the part of the Secret
+ * Service API that libgnome-keyring uses for bisho's calls.  There is a single
+ * collection, the default, which is never locked and needs no prompts.  Only
+ * plain sessions are offered, so secrets cross the bus unencrypted, and
+ * nothing is kept once it exits.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <gio/gio.h>
+
+#define SECRETS_NAME "org.freedesktop.secrets"
+#define SECRETS_PATH "/org/freedesktop/secrets"
+#define SESSION_PATH SECRETS_PATH "/session/"
+#define COLLECTION_PATH SECRETS_PATH "/collection/login"
+#define ITEM_PATH COLLECTION_PATH "/"
+
+#define SERVICE_INTERFACE "org.freedesktop.Secret.Service"
+#define COLLECTION_INTERFACE "org.freedesktop.Secret.Collection"
+#define ITEM_INTERFACE "org.freedesktop.Secret.Item"
+#define SESSION_INTERFACE "org.freedesktop.Secret.Session"
+
+#define SECRET_TYPE "(oayays)"
+
+static const char introspection_xml[] =
+  "<node>"
+  "  <interface name='" SERVICE_INTERFACE "'>"
+  "    <method name='OpenSession'>"
+  "      <arg type='s' name='algorithm' direction='in'/>"
+  "      <arg type='v' name='input' direction='in'/>"
+  "      <arg type='v' name='output' direction='out'/>"
+  "      <arg type='o' name='result' direction='out'/>"
+  "    </method>"
+  "    <method name='SearchItems'>"
+  "      <arg type='a{ss}' name='attributes' direction='in'/>"
+  "      <arg type='ao' name='unlocked' direction='out'/>"
+  "      <arg type='ao' name='locked' direction='out'/>"
+  "    </method>"
+  "    <method name='Unlock'>"
+  "      <arg type='ao' name='objects' direction='in'/>"
+  "      <arg type='ao' name='unlocked' direction='out'/>"
+  "      <arg type='o' name='prompt' direction='out'/>"
+  "    </method>"
+  "    <method name='Lock'>"
+  "      <arg type='ao' name='objects' direction='in'/>"
+  "      <arg type='ao' name='locked' direction='out'/>"
+  "      <arg type='o' name='prompt' direction='out'/>"
+  "    </method>"
+  "    <method name='GetSecrets'>"
+  "      <arg type='ao' name='items' direction='in'/>"
+  "      <arg type='o' name='session' direction='in'/>"
+  "      <arg type='a{o" SECRET_TYPE "}' name='secrets' direction='out'/>"
+  "    </method>"
+  "    <method name='ReadAlias'>"
+  "      <arg type='s' name='name' direction='in'/>"
+  "      <arg type='o' name='collection' direction='out'/>"
+  "    </method>"
+  "    <property name='Collections' type='ao' access='read'/>"
+  "  </interface>"
+  "  <interface name='" COLLECTION_INTERFACE "'>"
+  "    <method name='CreateItem'>"
+  "      <arg type='a{sv}' name='properties' direction='in'/>"
+  "      <arg type='" SECRET_TYPE "' name='secret' direction='in'/>"
+  "      <arg type='b' name='replace' direction='in'/>"
+  "      <arg type='o' name='item' direction='out'/>"
+  "      <arg type='o' name='prompt' direction='out'/>"
+  "    </method>"
+  "    <method name='SearchItems'>"
+  "      <arg type='a{ss}' name='attributes' direction='in'/>"
+  "      <arg type='ao' name='results' direction='out'/>"
+  "    </method>"
+  "    <property name='Items' type='ao' access='read'/>"
+  "    <property name='Label' type='s' access='read'/>"
+  "    <property name='Locked' type='b' access='read'/>"
+  "    <property name='Created' type='t' access='read'/>"
+  "    <property name='Modified' type='t' access='read'/>"
+  "  </interface>"
+  "  <interface name='" ITEM_INTERFACE "'>"
+  "    <method name='Delete'>"
+  "      <arg type='o' name='prompt' direction='out'/>"
+  "    </method>"
+  "    <method name='GetSecret'>"
+  "      <arg type='o' name='session' direction='in'/>"
+  "      <arg type='" SECRET_TYPE "' name='secret' direction='out'/>"
+  "    </method>"
+  "    <method name='SetSecret'>"
+  "      <arg type='" SECRET_TYPE "' name='secret' direction='in'/>"
+  "    </method>"
+  "    <property name='Attributes' type='a{ss}' access='readwrite'/>"
+  "    <property name='Label' type='s' access='readwrite'/>"
+  "    <property name='Locked' type='b' access='read'/>"
+  "    <property name='Created' type='t' access='read'/>"
+  "    <property name='Modified' type='t' access='read'/>"
+  "  </interface>"
+  "  <interface name='" SESSION_INTERFACE "'>"
+  "    <method name='Close'/>"
+  "  </interface>"
+  "</node>";
+
+typedef struct {
+  guint id;
+  guint registration_id;
+  char *label;
+  GHashTable *attributes;
+  GByteArray *secret;
+  char *content_type;
+  guint64 created;
+  guint64 modified;
+} Item;
+
+static GDBusNodeInfo *introspection = NULL;
+static GDBusConnection *bus = NULL;
+static GMainLoop *loop = NULL;
+/* Hash of item id to Item */
+static GHashTable *items = NULL;
+static guint next_item_id = 1;
+static guint next_session_id = 1;
+static guint64 created;
+static int ret = 0;
+
+static const GDBusInterfaceVTable item_vtable;
+static const GDBusInterfaceVTable session_vtable;
+
+static guint64
+now (void)
+{
+  return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static char *
+get_item_path (Item *item)
+{
+  return g_strdup_printf (ITEM_PATH "%u", item->id);
+}
+
+/* Returns the item at @path, or NULL if there isn't one */
+static Item *
+lookup_item (const char *path)
+{
+  char *end;
+  guint64 id;
+
+  if (!g_str_has_prefix (path, ITEM_PATH))
+    return NULL;
+
+  id = g_ascii_strtoull (path + strlen (ITEM_PATH), &end, 10);
+  if (*end != '\0')
+    return NULL;
+
+  return g_hash_table_lookup (items, GUINT_TO_POINTER ((guint)id));
+}
+
+static void
+item_free (Item *item)
+{
+  g_free (item->label);
+  g_hash_table_destroy (item->attributes);
+  g_byte_array_free (item->secret, TRUE);
+  g_free (item->content_type);
+  g_slice_free (Item, item);
+}
+
+static GHashTable *
+parse_attributes (GVariant *variant)
+{
+  GHashTable *attributes;
+  GVariantIter iter;
+  const char *key, *value;
+
+  attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "{&s&s}", &key, &value))
+    g_hash_table_insert (attributes, g_strdup (key), g_strdup (value));
+
+  return attributes;
+}
+
+static GVariant *
+build_attributes (GHashTable *attributes)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  g_hash_table_iter_init (&iter, attributes);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_variant_builder_add (&builder, "{ss}", key, value);
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Whether @item has every attribute in @query */
+static gboolean
+item_matches (Item *item, GHashTable *query)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, query);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    if (g_strcmp0 (g_hash_table_lookup (item->attributes, key), value) != 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* The items with every attribute in @query, as an array of object paths */
+static GVariant *
+search_items (GVariant *query_variant)
+{
+  GVariantBuilder builder;
+  GHashTable *query;
+  GHashTableIter iter;
+  gpointer value;
+
+  query = parse_attributes (query_variant);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+  g_hash_table_iter_init (&iter, items);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    if (item_matches (value, query)) {
+      char *path = get_item_path (value);
+      g_variant_builder_add (&builder, "o", path);
+      g_free (path);
+    }
+  }
+
+  g_hash_table_destroy (query);
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+build_bytes (const guint8 *data, gsize length)
+{
+  GVariantBuilder builder;
+  gsize i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("ay"));
+  for (i = 0; i < length; i++)
+    g_variant_builder_add (&builder, "y", data[i]);
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Secrets are sent as they are in a plain session, with no parameters */
+static GVariant *
+build_secret (Item *item, const char *session)
+{
+  return g_variant_new ("(o@ay@ays)", session,
+                        build_bytes (item->secret->data, item->secret->len),
+                        build_bytes (NULL, 0),
+                        item->content_type);
+}
+
+static void
+set_secret (Item *item, GVariant *secret)
+{
+  GVariant *value;
+  const guint8 *data;
+  const char *content_type;
+  gsize length;
+
+  g_variant_get (secret, "(&o@ay@ay&s)", NULL, NULL, &value, &content_type);
+  data = g_variant_get_fixed_array (value, &length, 1);
+
+  g_byte_array_set_size (item->secret, 0);
+  g_byte_array_append (item->secret, data, length);
+  g_free (item->content_type);
+  item->content_type = g_strdup (content_type);
+  item->modified = now ();
+
+  g_variant_unref (value);
+}
+
+static Item *
+create_item (GHashTable *attributes)
+{
+  Item *item;
+  char *path;
+  GError *error = NULL;
+
+  item = g_slice_new0 (Item);
+  item->id = next_item_id++;
+  item->label = g_strdup ("");
+  item->attributes = attributes;
+  item->secret = g_byte_array_new ();
+  item->content_type = g_strdup ("text/plain");
+  item->created = item->modified = now ();
+
+  path = get_item_path (item);
+  item->registration_id =
+    g_dbus_connection_register_object (bus, path,
+                                       introspection->interfaces[2],
+                                       &item_vtable, item, NULL, &error);
+  if (item->registration_id == 0) {
+    g_printerr ("Cannot register %s: %s\n", path, error->message);
+    g_error_free (error);
+  }
+  g_free (path);
+
+  g_hash_table_insert (items, GUINT_TO_POINTER (item->id), item);
+
+  return item;
+}
+
+/* Returns the item with exactly @attributes, or NULL if there isn't one */
+static Item *
+find_replaceable (GHashTable *attributes)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, items);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    Item *item = value;
+
+    if (g_hash_table_size (item->attributes) == g_hash_table_size (attributes) &&
+        item_matches (item, attributes))
+      return item;
+  }
+
+  return NULL;
+}
+
+static void
+delete_item (Item *item)
+{
+  if (item->registration_id)
+    g_dbus_connection_unregister_object (bus, item->registration_id);
+  g_hash_table_remove (items, GUINT_TO_POINTER (item->id));
+}
+
+static void
+open_session (GDBusMethodInvocation *invocation, const char *algorithm)
+{
+  char *path;
+
+  if (strcmp (algorithm, "plain") != 0) {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+                                           "Algorithm %s is not supported", algorithm);
+    return;
+  }
+
+  /* Sessions hold no state, so they stay until the store exits */
+  path = g_strdup_printf (SESSION_PATH "%u", next_session_id++);
+  g_dbus_connection_register_object (bus, path,
+                                     introspection->interfaces[3],
+                                     &session_vtable, NULL, NULL, NULL);
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(vo)", g_variant_new_string (""), path));
+  g_free (path);
+}
+
+static GVariant *
+get_secrets (GVariant *paths, const char *session)
+{
+  GVariantBuilder builder;
+  GVariantIter iter;
+  const char *path;
+  Item *item;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{o" SECRET_TYPE "}"));
+  g_variant_iter_init (&iter, paths);
+  while (g_variant_iter_next (&iter, "&o", &path)) {
+    item = lookup_item (path);
+    if (item)
+      g_variant_builder_add (&builder, "{o@" SECRET_TYPE "}", path, build_secret (item, session));
+  }
+
+  return g_variant_new ("(@a{o" SECRET_TYPE "})", g_variant_builder_end (&builder));
+}
+
+static void
+service_method_cb (GDBusConnection       *connection,
+                   const gchar           *sender,
+                   const gchar           *object_path,
+                   const gchar           *interface_name,
+                   const gchar           *method_name,
+                   GVariant              *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer               user_data)
+{
+  if (strcmp (method_name, "OpenSession") == 0) {
+    const char *algorithm;
+
+    g_variant_get (parameters, "(&sv)", &algorithm, NULL);
+    open_session (invocation, algorithm);
+  } else if (strcmp (method_name, "SearchItems") == 0) {
+    GVariant *query = g_variant_get_child_value (parameters, 0);
+
+    /* Nothing is ever locked */
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@ao@ao)", search_items (query),
+                                                          g_variant_new_array (G_VARIANT_TYPE_OBJECT_PATH, NULL, 0)));
+    g_variant_unref (query);
+  } else if (strcmp (method_name, "Unlock") == 0) {
+    GVariant *objects = g_variant_get_child_value (parameters, 0);
+
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@aoo)", objects, "/"));
+    g_variant_unref (objects);
+  } else if (strcmp (method_name, "Lock") == 0) {
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@aoo)",
+                                                          g_variant_new_array (G_VARIANT_TYPE_OBJECT_PATH, NULL, 0),
+                                                          "/"));
+  } else if (strcmp (method_name, "GetSecrets") == 0) {
+    GVariant *paths;
+    const char *session;
+
+    g_variant_get (parameters, "(@ao&o)", &paths, &session);
+    g_dbus_method_invocation_return_value (invocation, get_secrets (paths, session));
+    g_variant_unref (paths);
+  } else if (strcmp (method_name, "ReadAlias") == 0) {
+    const char *name;
+
+    g_variant_get (parameters, "(&s)", &name);
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(o)",
+                                                          strcmp (name, "default") == 0 ||
+                                                          strcmp (name, "login") == 0 ?
+                                                          COLLECTION_PATH : "/"));
+  } else {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method_name);
+  }
+}
+
+static GVariant *
+service_get_property_cb (GDBusConnection  *connection,
+                         const gchar      *sender,
+                         const gchar      *object_path,
+                         const gchar      *interface_name,
+                         const gchar      *property_name,
+                         GError          **error,
+                         gpointer          user_data)
+{
+  GVariant *collection = g_variant_new_object_path (COLLECTION_PATH);
+
+  return g_variant_new_array (G_VARIANT_TYPE_OBJECT_PATH, &collection, 1);
+}
+
+static void
+create_item_call (GDBusMethodInvocation *invocation, GVariant *parameters)
+{
+  GVariant *properties, *secret, *value;
+  GVariantIter iter;
+  GHashTable *attributes = NULL;
+  const char *key;
+  char *label = NULL, *path;
+  gboolean replace;
+  Item *item = NULL;
+
+  g_variant_get (parameters, "(@a{sv}@" SECRET_TYPE "b)", &properties, &secret, &replace);
+
+  g_variant_iter_init (&iter, properties);
+  while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+    if (strcmp (key, ITEM_INTERFACE ".Label") == 0) {
+      g_free (label);
+      label = g_variant_dup_string (value, NULL);
+    } else if (strcmp (key, ITEM_INTERFACE ".Attributes") == 0) {
+      if (attributes)
+        g_hash_table_destroy (attributes);
+      attributes = parse_attributes (value);
+    }
+    g_variant_unref (value);
+  }
+
+  if (attributes == NULL)
+    attributes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (replace)
+    item = find_replaceable (attributes);
+
+  if (item)
+    g_hash_table_destroy (attributes);
+  else
+    item = create_item (attributes);
+
+  if (label) {
+    g_free (item->label);
+    item->label = label;
+  }
+  set_secret (item, secret);
+
+  path = get_item_path (item);
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(oo)", path, "/"));
+  g_free (path);
+
+  g_variant_unref (properties);
+  g_variant_unref (secret);
+}
+
+static void
+collection_method_cb (GDBusConnection       *connection,
+                      const gchar           *sender,
+                      const gchar           *object_path,
+                      const gchar           *interface_name,
+                      const gchar           *method_name,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation,
+                      gpointer               user_data)
+{
+  if (strcmp (method_name, "CreateItem") == 0) {
+    create_item_call (invocation, parameters);
+  } else if (strcmp (method_name, "SearchItems") == 0) {
+    GVariant *query = g_variant_get_child_value (parameters, 0);
+
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@ao)", search_items (query)));
+    g_variant_unref (query);
+  } else {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method_name);
+  }
+}
+
+static GVariant *
+collection_get_property_cb (GDBusConnection  *connection,
+                            const gchar      *sender,
+                            const gchar      *object_path,
+                            const gchar      *interface_name,
+                            const gchar      *property_name,
+                            GError          **error,
+                            gpointer          user_data)
+{
+  if (strcmp (property_name, "Items") == 0) {
+    GVariant *all, *result;
+
+    all = g_variant_new_array (G_VARIANT_TYPE ("{ss}"), NULL, 0);
+    result = search_items (all);
+    g_variant_unref (g_variant_ref_sink (all));
+
+    return result;
+  } else if (strcmp (property_name, "Label") == 0) {
+    return g_variant_new_string ("Login");
+  } else if (strcmp (property_name, "Locked") == 0) {
+    return g_variant_new_boolean (FALSE);
+  } else {
+    return g_variant_new_uint64 (created);
+  }
+}
+
+static void
+item_method_cb (GDBusConnection       *connection,
+                const gchar           *sender,
+                const gchar           *object_path,
+                const gchar           *interface_name,
+                const gchar           *method_name,
+                GVariant              *parameters,
+                GDBusMethodInvocation *invocation,
+                gpointer               user_data)
+{
+  Item *item = user_data;
+
+  if (strcmp (method_name, "GetSecret") == 0) {
+    const char *session;
+
+    g_variant_get (parameters, "(&o)", &session);
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@" SECRET_TYPE ")",
+                                                          build_secret (item, session)));
+  } else if (strcmp (method_name, "SetSecret") == 0) {
+    GVariant *secret = g_variant_get_child_value (parameters, 0);
+
+    set_secret (item, secret);
+    g_variant_unref (secret);
+    g_dbus_method_invocation_return_value (invocation, NULL);
+  } else if (strcmp (method_name, "Delete") == 0) {
+    /* Answer first, as the item is freed along with its registration */
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/"));
+    delete_item (item);
+  } else {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method_name);
+  }
+}
+
+static GVariant *
+item_get_property_cb (GDBusConnection  *connection,
+                      const gchar      *sender,
+                      const gchar      *object_path,
+                      const gchar      *interface_name,
+                      const gchar      *property_name,
+                      GError          **error,
+                      gpointer          user_data)
+{
+  Item *item = user_data;
+
+  if (strcmp (property_name, "Attributes") == 0)
+    return build_attributes (item->attributes);
+  else if (strcmp (property_name, "Label") == 0)
+    return g_variant_new_string (item->label);
+  else if (strcmp (property_name, "Locked") == 0)
+    return g_variant_new_boolean (FALSE);
+  else if (strcmp (property_name, "Created") == 0)
+    return g_variant_new_uint64 (item->created);
+  else
+    return g_variant_new_uint64 (item->modified);
+}
+
+static gboolean
+item_set_property_cb (GDBusConnection  *connection,
+                      const gchar      *sender,
+                      const gchar      *object_path,
+                      const gchar      *interface_name,
+                      const gchar      *property_name,
+                      GVariant         *value,
+                      GError          **error,
+                      gpointer          user_data)
+{
+  Item *item = user_data;
+
+  if (strcmp (property_name, "Attributes") == 0) {
+    g_hash_table_destroy (item->attributes);
+    item->attributes = parse_attributes (value);
+  } else {
+    g_free (item->label);
+    item->label = g_variant_dup_string (value, NULL);
+  }
+  item->modified = now ();
+
+  return TRUE;
+}
+
+static void
+session_method_cb (GDBusConnection       *connection,
+                   const gchar           *sender,
+                   const gchar           *object_path,
+                   const gchar           *interface_name,
+                   const gchar           *method_name,
+                   GVariant              *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer               user_data)
+{
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static const GDBusInterfaceVTable service_vtable = {
+  service_method_cb,
+  service_get_property_cb,
+  NULL
+};
+
+static const GDBusInterfaceVTable collection_vtable = {
+  collection_method_cb,
+  collection_get_property_cb,
+  NULL
+};
+
+static const GDBusInterfaceVTable item_vtable = {
+  item_method_cb,
+  item_get_property_cb,
+  item_set_property_cb
+};
+
+static const GDBusInterfaceVTable session_vtable = {
+  session_method_cb,
+  NULL,
+  NULL
+};
+
+static void
+bus_acquired_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  GError *error = NULL;
+
+  bus = connection;
+
+  if (!g_dbus_connection_register_object (connection, SECRETS_PATH,
+                                          introspection->interfaces[0],
+                                          &service_vtable, NULL, NULL, &error) ||
+      !g_dbus_connection_register_object (connection, COLLECTION_PATH,
+                                          introspection->interfaces[1],
+                                          &collection_vtable, NULL, NULL, &error)) {
+    g_printerr ("Cannot register the secret store: %s\n", error->message);
+    g_error_free (error);
+    ret = 1;
+    g_main_loop_quit (loop);
+  }
+}
+
+static void
+name_lost_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  g_printerr ("Cannot own %s on the session bus\n", name);
+  ret = 1;
+  g_main_loop_quit (loop);
+}
+
+int
+main (int argc, char **argv)
+{
+  guint owner_id;
+
+  g_type_init ();
+
+  introspection = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  g_assert (introspection);
+
+  items = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)item_free);
+  created = now ();
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, SECRETS_NAME,
+                             G_BUS_NAME_OWNER_FLAGS_NONE,
+                             bus_acquired_cb, NULL, name_lost_cb,
+                             NULL, NULL);
+
+  g_main_loop_run (loop);
+
+  g_bus_unown_name (owner_id);
+
+  return ret;
+}
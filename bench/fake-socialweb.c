@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A stand-in for the libsocialweb core on the session bus, with just the calls
+ * bisho makes.  It writes descriptors for N synthetic user name and password
+ * services to --data-dir, and then offers every service described there, so
+ * that the descriptors written by oauth-stub are included too.  Every service
+ * is online, has no capabilities and ignores credential updates.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+
+#define SW_NAME "org.gnome.libsocialweb"
+#define SW_PATH "/org/gnome/libsocialweb"
+#define SW_INTERFACE "org.gnome.libsocialweb"
+#define SW_SERVICE_PATH SW_PATH "/Service/"
+#define SW_SERVICE_INTERFACE "org.gnome.libsocialweb.Service"
+
+static const char introspection_xml[] =
+  "<node>"
+  "  <interface name='" SW_INTERFACE "'>"
+  "    <method name='GetServices'>"
+  "      <arg type='as' name='services' direction='out'/>"
+  "    </method>"
+  "    <method name='IsOnline'>"
+  "      <arg type='b' name='online' direction='out'/>"
+  "    </method>"
+  "    <signal name='OnlineChanged'>"
+  "      <arg type='b' name='online'/>"
+  "    </signal>"
+  "  </interface>"
+  "  <interface name='" SW_SERVICE_INTERFACE "'>"
+  "    <method name='GetStaticCapabilities'>"
+  "      <arg type='as' name='caps' direction='out'/>"
+  "    </method>"
+  "    <method name='GetDynamicCapabilities'>"
+  "      <arg type='as' name='caps' direction='out'/>"
+  "    </method>"
+  "    <method name='CredentialsUpdated'/>"
+  "    <signal name='CapabilitiesChanged'>"
+  "      <arg type='as' name='caps'/>"
+  "    </signal>"
+  "    <signal name='UserChanged'/>"
+  "  </interface>"
+  "</node>";
+
+static char *opt_data_dir = NULL;
+static int opt_services = 10;
+static int opt_latency = 0;
+
+static const GOptionEntry options[] = {
+  { "data-dir", 'd', 0, G_OPTION_ARG_FILENAME, &opt_data_dir,
+    "Write and read the service descriptors in DIR", "DIR" },
+  { "services", 'n', 0, G_OPTION_ARG_INT, &opt_services,
+    "Write N synthetic services", "N" },
+  { "latency", 'l', 0, G_OPTION_ARG_INT, &opt_latency,
+    "Answer each call after MS milliseconds", "MS" },
+  { NULL }
+};
+
+static GDBusNodeInfo *introspection = NULL;
+static GMainLoop *loop = NULL;
+/* The names of the services, sorted */
+static GPtrArray *names = NULL;
+static int ret = 0;
+
+/* A reply held back for the latency */
+typedef struct {
+  GDBusMethodInvocation *invocation;
+  GVariant *value;
+} Reply;
+
+static char *
+get_services_dir (void)
+{
+  return g_build_filename (opt_data_dir, "libsocialweb", "services", NULL);
+}
+
+/* Half of the services take a user name and the other half a password too */
+static gboolean
+write_services (void)
+{
+  char *dir, *filename, *contents;
+  GError *error = NULL;
+  gboolean ok = TRUE;
+  int i;
+
+  dir = get_services_dir ();
+  g_mkdir_with_parents (dir, 0700);
+
+  for (i = 0; ok && i < opt_services; i++) {
+    char *name;
+
+    name = g_strdup_printf ("fake%d.keys", i);
+    filename = g_build_filename (dir, name, NULL);
+    contents = g_strdup_printf ("[LibSocialWebService]\n"
+                                "Name=Fake %d\n"
+                                "Description=A synthetic service\n"
+                                "AuthType=%s\n"
+                                "AuthPasswordServer=fake%d.example.com\n",
+                                i, i % 2 ? "password" : "username", i);
+
+    if (!g_file_set_contents (filename, contents, -1, &error)) {
+      g_printerr ("Cannot write %s: %s\n", filename, error->message);
+      g_error_free (error);
+      ok = FALSE;
+    }
+
+    g_free (contents);
+    g_free (filename);
+    g_free (name);
+  }
+
+  g_free (dir);
+
+  return ok;
+}
+
+static int
+compare_names (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const char **)a, *(const char **)b);
+}
+
+static void
+load_names (void)
+{
+  const char *filename;
+  char *dir, *name, *path;
+  GDir *d;
+
+  names = g_ptr_array_new_with_free_func (g_free);
+
+  dir = get_services_dir ();
+  d = g_dir_open (dir, 0, NULL);
+  g_free (dir);
+  if (d == NULL)
+    return;
+
+  while ((filename = g_dir_read_name (d))) {
+    if (!g_str_has_suffix (filename, ".keys"))
+      continue;
+
+    name = g_strndup (filename, strlen (filename) - strlen (".keys"));
+
+    /* The name has to be usable in an object path */
+    path = g_strconcat (SW_SERVICE_PATH, name, NULL);
+    if (g_variant_is_object_path (path))
+      g_ptr_array_add (names, name);
+    else
+      g_free (name);
+    g_free (path);
+  }
+
+  g_dir_close (d);
+
+  g_ptr_array_sort (names, compare_names);
+}
+
+static gboolean
+reply_cb (gpointer data)
+{
+  Reply *reply = data;
+
+  g_dbus_method_invocation_return_value (reply->invocation, reply->value);
+  g_slice_free (Reply, reply);
+
+  return FALSE;
+}
+
+static void
+reply (GDBusMethodInvocation *invocation, GVariant *value)
+{
+  Reply *r;
+
+  if (opt_latency <= 0) {
+    g_dbus_method_invocation_return_value (invocation, value);
+    return;
+  }
+
+  r = g_slice_new (Reply);
+  r->invocation = invocation;
+  r->value = value;
+  g_timeout_add (opt_latency, reply_cb, r);
+}
+
+static GVariant *
+get_services (void)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+  for (i = 0; i < names->len; i++)
+    g_variant_builder_add (&builder, "s", g_ptr_array_index (names, i));
+
+  return g_variant_new ("(as)", &builder);
+}
+
+static void
+method_call_cb (GDBusConnection       *connection,
+                const gchar           *sender,
+                const gchar           *object_path,
+                const gchar           *interface_name,
+                const gchar           *method_name,
+                GVariant              *parameters,
+                GDBusMethodInvocation *invocation,
+                gpointer               user_data)
+{
+  if (strcmp (method_name, "GetServices") == 0) {
+    reply (invocation, get_services ());
+  } else if (strcmp (method_name, "IsOnline") == 0) {
+    reply (invocation, g_variant_new ("(b)", TRUE));
+  } else if (strcmp (method_name, "GetStaticCapabilities") == 0 ||
+             strcmp (method_name, "GetDynamicCapabilities") == 0) {
+    reply (invocation, g_variant_new ("(as)", NULL));
+  } else if (strcmp (method_name, "CredentialsUpdated") == 0) {
+    reply (invocation, NULL);
+  } else {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method_name);
+  }
+}
+
+static const GDBusInterfaceVTable vtable = {
+  method_call_cb,
+  NULL,
+  NULL
+};
+
+static void
+bus_acquired_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  GError *error = NULL;
+  char *path;
+  guint i;
+
+  if (!g_dbus_connection_register_object (connection, SW_PATH,
+                                          introspection->interfaces[0],
+                                          &vtable, NULL, NULL, &error)) {
+    g_printerr ("Cannot register %s: %s\n", SW_PATH, error->message);
+    g_error_free (error);
+    ret = 1;
+    g_main_loop_quit (loop);
+    return;
+  }
+
+  for (i = 0; i < names->len; i++) {
+    path = g_strconcat (SW_SERVICE_PATH, g_ptr_array_index (names, i), NULL);
+    if (!g_dbus_connection_register_object (connection, path,
+                                            introspection->interfaces[1],
+                                            &vtable, NULL, NULL, &error)) {
+      g_printerr ("Cannot register %s: %s\n", path, error->message);
+      g_clear_error (&error);
+    }
+    g_free (path);
+  }
+}
+
+static void
+name_lost_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  g_printerr ("Cannot own %s on the session bus\n", name);
+  ret = 1;
+  g_main_loop_quit (loop);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  guint owner_id;
+
+  g_type_init ();
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_data_dir == NULL) {
+    g_printerr ("--data-dir is required\n");
+    return 1;
+  }
+
+  if (!write_services ())
+    return 1;
+  load_names ();
+
+  introspection = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  g_assert (introspection);
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, SW_NAME,
+                             G_BUS_NAME_OWNER_FLAGS_NONE,
+                             bus_acquired_cb, NULL, name_lost_cb,
+                             NULL, NULL);
+
+  g_main_loop_run (loop);
+
+  g_bus_unown_name (owner_id);
+
+  return ret;
+}
@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A local OAuth 1.0 and 1.0a provider, for driving the OAuth pane without a
+ * real service.  It serves request_token, authorize and access_token under
+ * its root, with a configurable latency, error rate and number of requests
+ * handled at once.  Signatures are not checked, but tokens are: an access
+ * token is only given for an authorized request token, once, and with the
+ * right verifier if the client asked for 1.0a.
+ *
+ * With --data-dir it also writes service descriptors and consumer keys for
+ * libsocialweb pointing at itself, so that setting XDG_DATA_HOME to the same
+ * directory makes bisho show them.  The port is printed on standard output
+ * once the server is listening.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+
+static int opt_port = 0;
+static int opt_latency = 0;
+static int opt_jitter = 0;
+static double opt_error_rate = 0.0;
+static int opt_error_status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+static int opt_concurrency = 0;
+static gboolean opt_auto_authorize = FALSE;
+static char *opt_verifier = NULL;
+static char *opt_data_dir = NULL;
+static int opt_services = 1;
+static char *opt_flow = NULL;
+
+static const GOptionEntry options[] = {
+  { "port", 'p', 0, G_OPTION_ARG_INT, &opt_port,
+    "Listen on PORT, or any free port if 0", "PORT" },
+  { "latency", 'l', 0, G_OPTION_ARG_INT, &opt_latency,
+    "Answer each request after MS milliseconds", "MS" },
+  { "jitter", 'j', 0, G_OPTION_ARG_INT, &opt_jitter,
+    "Add up to MS random milliseconds to the latency", "MS" },
+  { "error-rate", 'e', 0, G_OPTION_ARG_DOUBLE, &opt_error_rate,
+    "Fail this fraction of requests", "FRACTION" },
+  { "error-status", 0, 0, G_OPTION_ARG_INT, &opt_error_status,
+    "The HTTP status of failed requests", "STATUS" },
+  { "concurrency", 'c', 0, G_OPTION_ARG_INT, &opt_concurrency,
+    "Handle at most N requests at once, queueing the rest, or any number if 0", "N" },
+  { "auto-authorize", 'a', 0, G_OPTION_ARG_NONE, &opt_auto_authorize,
+    "Authorize request tokens as soon as they are issued", NULL },
+  { "verifier", 0, 0, G_OPTION_ARG_STRING, &opt_verifier,
+    "Give VERIFIER for every authorized token instead of a random one", "VERIFIER" },
+  { "data-dir", 'd', 0, G_OPTION_ARG_FILENAME, &opt_data_dir,
+    "Write libsocialweb service descriptors and keys to DIR", "DIR" },
+  { "services", 'n', 0, G_OPTION_ARG_INT, &opt_services,
+    "Write N service descriptors", "N" },
+  { "flow", 'f', 0, G_OPTION_ARG_STRING, &opt_flow,
+    "Make the services use 1.0, 1.0a-oob or 1.0a (redirect)", "FLOW" },
+  { NULL }
+};
+
+/* An issued request token */
+typedef struct {
+  char *secret;
+  /* The callback given when the token was requested, if this is 1.0a */
+  char *callback;
+  /* Set when the token is authorized */
+  char *verifier;
+} RequestToken;
+
+/* A request waiting for its turn or its latency */
+typedef struct {
+  SoupMessage *msg;
+  char *path;
+  GHashTable *query;
+} Pending;
+
+static SoupServer *server = NULL;
+/* Hash of token to RequestToken */
+static GHashTable *request_tokens = NULL;
+static guint serial = 0;
+static int in_flight = 0;
+static GQueue *waiting = NULL;
+
+static void start_pending (Pending *pending);
+
+static void
+request_token_free (RequestToken *token)
+{
+  g_free (token->secret);
+  g_free (token->callback);
+  g_free (token->verifier);
+  g_slice_free (RequestToken, token);
+}
+
+static void
+pending_free (Pending *pending)
+{
+  g_object_unref (pending->msg);
+  g_free (pending->path);
+  if (pending->query)
+    g_hash_table_unref (pending->query);
+  g_slice_free (Pending, pending);
+}
+
+static void
+copy_param (gpointer key, gpointer value, gpointer user_data)
+{
+  g_hash_table_insert (user_data, g_strdup (key), g_strdup (value));
+}
+
+/*
+ * Collect the parameters of @pending from the query, a form body and the OAuth
+ * Authorization header, which is where librest puts the token.
+ */
+static GHashTable *
+get_params (Pending *pending)
+{
+  SoupMessage *msg = pending->msg;
+  GHashTable *params, *form, *auth;
+  GHashTableIter iter;
+  gpointer key, value;
+  SoupBuffer *body;
+  const char *header;
+
+  params = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (pending->query)
+    g_hash_table_foreach (pending->query, copy_param, params);
+
+  body = soup_message_body_flatten (msg->request_body);
+  if (body->length) {
+    form = soup_form_decode (body->data);
+    g_hash_table_foreach (form, copy_param, params);
+    g_hash_table_destroy (form);
+  }
+  soup_buffer_free (body);
+
+  header = soup_message_headers_get_one (msg->request_headers, "Authorization");
+  if (header && g_ascii_strncasecmp (header, "OAuth ", 6) == 0) {
+    auth = soup_header_parse_param_list (header + 6);
+    g_hash_table_iter_init (&iter, auth);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+      if (value)
+        g_hash_table_insert (params, g_strdup (key), soup_uri_decode (value));
+    }
+    soup_header_free_param_list (auth);
+  }
+
+  return params;
+}
+
+static void
+set_form_response (SoupMessage *msg, guint status, char *body)
+{
+  soup_message_set_status (msg, status);
+  soup_message_set_response (msg, "application/x-www-form-urlencoded",
+                             SOUP_MEMORY_TAKE, body, strlen (body));
+}
+
+static void
+authorize_token (RequestToken *token)
+{
+  g_free (token->verifier);
+  if (opt_verifier)
+    token->verifier = g_strdup (opt_verifier);
+  else
+    token->verifier = g_strdup_printf ("%08x", g_random_int ());
+}
+
+static void
+handle_request_token (SoupMessage *msg, GHashTable *params)
+{
+  RequestToken *token;
+  const char *callback;
+  char *key;
+
+  token = g_slice_new0 (RequestToken);
+  token->secret = g_strdup_printf ("rs%u", ++serial);
+  callback = g_hash_table_lookup (params, "oauth_callback");
+  if (callback && callback[0])
+    token->callback = g_strdup (callback);
+  if (opt_auto_authorize)
+    authorize_token (token);
+
+  key = g_strdup_printf ("rt%u", serial);
+  g_hash_table_insert (request_tokens, key, token);
+
+  set_form_response (msg, SOUP_STATUS_OK,
+                     g_strdup_printf ("oauth_token=%s&oauth_token_secret=%s%s",
+                                      key, token->secret,
+                                      token->callback ? "&oauth_callback_confirmed=true" : ""));
+}
+
+static void
+handle_authorize (SoupMessage *msg, GHashTable *params)
+{
+  RequestToken *token;
+  const char *key;
+  char *body, *location;
+
+  key = g_hash_table_lookup (params, "oauth_token");
+  token = key ? g_hash_table_lookup (request_tokens, key) : NULL;
+  if (token == NULL) {
+    set_form_response (msg, SOUP_STATUS_UNAUTHORIZED,
+                       g_strdup ("oauth_problem=token_rejected"));
+    return;
+  }
+
+  authorize_token (token);
+
+  if (token->callback && strcmp (token->callback, "oob") != 0) {
+    location = g_strdup_printf ("%s%soauth_token=%s&oauth_verifier=%s",
+                                token->callback,
+                                strchr (token->callback, '?') ? "&" : "?",
+                                key, token->verifier);
+    soup_message_set_status (msg, SOUP_STATUS_FOUND);
+    soup_message_headers_replace (msg->response_headers, "Location", location);
+    g_free (location);
+    return;
+  }
+
+  if (token->callback)
+    body = g_strdup_printf ("<html><body><p>Your code is %s</p></body></html>",
+                            token->verifier);
+  else
+    body = g_strdup ("<html><body><p>Authorized, return to the application.</p></body></html>");
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  soup_message_set_response (msg, "text/html", SOUP_MEMORY_TAKE, body, strlen (body));
+}
+
+static void
+handle_access_token (SoupMessage *msg, GHashTable *params)
+{
+  RequestToken *token;
+  const char *key, *verifier;
+
+  key = g_hash_table_lookup (params, "oauth_token");
+  token = key ? g_hash_table_lookup (request_tokens, key) : NULL;
+  if (token == NULL || token->verifier == NULL) {
+    set_form_response (msg, SOUP_STATUS_UNAUTHORIZED,
+                       g_strdup ("oauth_problem=token_rejected"));
+    return;
+  }
+
+  /* 1.0a clients must prove that the user authorized this token */
+  verifier = g_hash_table_lookup (params, "oauth_verifier");
+  if (token->callback && g_strcmp0 (verifier, token->verifier) != 0) {
+    set_form_response (msg, SOUP_STATUS_UNAUTHORIZED,
+                       g_strdup ("oauth_problem=verifier_invalid"));
+    return;
+  }
+
+  /* Request tokens can only be exchanged once */
+  g_hash_table_remove (request_tokens, key);
+
+  serial++;
+  set_form_response (msg, SOUP_STATUS_OK,
+                     g_strdup_printf ("oauth_token=at%u&oauth_token_secret=as%u",
+                                      serial, serial));
+}
+
+static void
+handle (Pending *pending)
+{
+  GHashTable *params;
+
+  if (opt_error_rate > 0 && g_random_double () < opt_error_rate) {
+    set_form_response (pending->msg, opt_error_status,
+                       g_strdup ("oauth_problem=injected_failure"));
+    return;
+  }
+
+  params = get_params (pending);
+
+  if (strcmp (pending->path, "/request_token") == 0)
+    handle_request_token (pending->msg, params);
+  else if (strcmp (pending->path, "/authorize") == 0)
+    handle_authorize (pending->msg, params);
+  else if (strcmp (pending->path, "/access_token") == 0)
+    handle_access_token (pending->msg, params);
+  else
+    soup_message_set_status (pending->msg, SOUP_STATUS_NOT_FOUND);
+
+  g_hash_table_destroy (params);
+}
+
+static gboolean
+finish_pending (gpointer data)
+{
+  Pending *pending = data;
+
+  handle (pending);
+  soup_server_unpause_message (server, pending->msg);
+  pending_free (pending);
+
+  in_flight--;
+  if (!g_queue_is_empty (waiting))
+    start_pending (g_queue_pop_head (waiting));
+
+  return FALSE;
+}
+
+static void
+start_pending (Pending *pending)
+{
+  guint delay;
+
+  in_flight++;
+
+  delay = opt_latency;
+  if (opt_jitter > 0)
+    delay += g_random_int_range (0, opt_jitter + 1);
+
+  g_timeout_add (delay, finish_pending, pending);
+}
+
+static void
+server_cb (SoupServer        *_server,
+           SoupMessage       *msg,
+           const char        *path,
+           GHashTable        *query,
+           SoupClientContext *client,
+           gpointer           user_data)
+{
+  Pending *pending;
+
+  pending = g_slice_new0 (Pending);
+  pending->msg = g_object_ref (msg);
+  pending->path = g_strdup (path);
+  if (query) {
+    pending->query = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_foreach (query, copy_param, pending->query);
+  }
+
+  /* Every request is answered from the main loop, after the latency */
+  soup_server_pause_message (_server, msg);
+
+  if (opt_concurrency > 0 && in_flight >= opt_concurrency)
+    g_queue_push_tail (waiting, pending);
+  else
+    start_pending (pending);
+}
+
+static gboolean
+write_file (const char *dir, const char *name, const char *contents)
+{
+  GError *error = NULL;
+  char *filename;
+  gboolean ret;
+
+  g_mkdir_with_parents (dir, 0700);
+
+  filename = g_build_filename (dir, name, NULL);
+  ret = g_file_set_contents (filename, contents, -1, &error);
+  if (!ret) {
+    g_printerr ("Cannot write %s: %s\n", filename, error->message);
+    g_error_free (error);
+  }
+  g_free (filename);
+
+  return ret;
+}
+
+/*
+ * Write the descriptors for services stub0 to stubN-1 to @data_dir, and their
+ * consumer keys in the keystore's format of the key and secret on two lines.
+ */
+static gboolean
+write_services (const char *data_dir, guint port)
+{
+  char *services_dir, *keys_dir, *callback = NULL;
+  gboolean ret = TRUE;
+  int i;
+
+  services_dir = g_build_filename (data_dir, "libsocialweb", "services", NULL);
+  keys_dir = g_build_filename (data_dir, "libsocialweb", "keys", NULL);
+
+  for (i = 0; i < opt_services && ret; i++) {
+    char *name, *filename, *contents;
+
+    name = g_strdup_printf ("stub%d", i);
+
+    if (g_strcmp0 (opt_flow, "1.0a-oob") == 0)
+      callback = g_strdup ("Callback=oob\n");
+    else if (g_strcmp0 (opt_flow, "1.0a") == 0)
+      callback = g_strdup_printf ("Callback=x-bisho:%s\n", name);
+    else
+      callback = g_strdup ("");
+
+    contents = g_strdup_printf ("[LibSocialWebService]\n"
+                                "Name=Stub %d\n"
+                                "Description=A local OAuth provider\n"
+                                "AuthType=oauth\n"
+                                "\n"
+                                "[OAuth]\n"
+                                "BaseURL=http://127.0.0.1:%u/\n"
+                                "RequestTokenFunction=request_token\n"
+                                "AuthoriseFunction=authorize\n"
+                                "AccessTokenFunction=access_token\n"
+                                "%s",
+                                i, port, callback);
+    filename = g_strconcat (name, ".keys", NULL);
+    ret = write_file (services_dir, filename, contents);
+    g_free (filename);
+    g_free (contents);
+    g_free (callback);
+
+    if (ret) {
+      contents = g_strdup_printf ("key-%s\nsecret-%s\n", name, name);
+      ret = write_file (keys_dir, name, contents);
+      g_free (contents);
+    }
+
+    g_free (name);
+  }
+
+  g_free (services_dir);
+  g_free (keys_dir);
+
+  return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  SoupAddress *address;
+  GMainLoop *loop;
+  guint port;
+
+  g_thread_init (NULL);
+  g_type_init ();
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_flow && strcmp (opt_flow, "1.0") != 0 &&
+      strcmp (opt_flow, "1.0a-oob") != 0 && strcmp (opt_flow, "1.0a") != 0) {
+    g_printerr ("Unknown flow %s\n", opt_flow);
+    return 1;
+  }
+
+  request_tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify)request_token_free);
+  waiting = g_queue_new ();
+
+  /* Only listen locally */
+  address = soup_address_new ("127.0.0.1", opt_port);
+  if (soup_address_resolve_sync (address, NULL) != SOUP_STATUS_OK) {
+    g_printerr ("Cannot resolve the local address\n");
+    return 1;
+  }
+
+  server = soup_server_new (SOUP_SERVER_INTERFACE, address, NULL);
+  g_object_unref (address);
+  if (server == NULL) {
+    g_printerr ("Cannot listen on port %d\n", opt_port);
+    return 1;
+  }
+
+  soup_server_add_handler (server, NULL, server_cb, NULL, NULL);
+  soup_server_run_async (server);
+
+  port = soup_server_get_port (server);
+
+  if (opt_data_dir && !write_services (opt_data_dir, port))
+    return 1;
+
+  g_print ("%u\n", port);
+  fflush (stdout);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (loop);
+
+  return 0;
+}
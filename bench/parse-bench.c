@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times the Flickr response parser on canned replies to the auth calls, against
+ * building a RestXmlNode tree and searching it as the pane used to.  The
+ * results are printed as JSON, in microseconds per response.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+#include <rest/rest-xml-parser.h>
+#include "flickr-response.h"
+
+static const char get_token_response[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+  "<rsp stat=\"ok\">\n"
+  "<auth>\n"
+  "  <token>72157623456789012-0123456789abcdef</token>\n"
+  "  <perms>write</perms>\n"
+  "  <user nsid=\"12345678@N00\" username=\"bisho\" fullname=\"Bisho Tester\" />\n"
+  "</auth>\n"
+  "</rsp>\n";
+
+static const char check_token_response[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+  "<rsp stat=\"ok\">\n"
+  "<auth>\n"
+  "  <token>72157623456789012-0123456789abcdef</token>\n"
+  "  <perms>write</perms>\n"
+  "  <user nsid=\"12345678@N00\" username=\"bisho\" fullname=\"\" />\n"
+  "</auth>\n"
+  "</rsp>\n";
+
+static const char invalid_token_response[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+  "<rsp stat=\"fail\">\n"
+  "  <err code=\"98\" msg=\"Invalid auth token\" />\n"
+  "</rsp>\n";
+
+static const struct {
+  const char *name;
+  const char *payload;
+} responses[] = {
+  { "getToken", get_token_response },
+  { "checkToken", check_token_response },
+  { "invalidToken", invalid_token_response },
+};
+
+static int opt_iterations = 100000;
+
+static const GOptionEntry options[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations,
+    "Parse each response N times", "N" },
+  { NULL }
+};
+
+/* Stops the compiler from dropping the work */
+static volatile gsize sink;
+
+static void
+parse_stream (const char *payload)
+{
+  FlickrResponse response = { NULL, };
+
+  flickr_response_parse (payload, -1, &response, NULL);
+  sink += response.token ? strlen (response.token) : response.error_code;
+  flickr_response_clear (&response);
+}
+
+static void
+parse_tree (RestXmlParser *parser, const char *payload)
+{
+  RestXmlNode *root, *node;
+
+  root = rest_xml_parser_parse_from_data (parser, payload, strlen (payload));
+  if (root == NULL)
+    return;
+
+  if (g_strcmp0 (rest_xml_node_get_attr (root, "stat"), "ok") != 0) {
+    node = rest_xml_node_find (root, "err");
+    if (node)
+      sink += g_ascii_strtoll (rest_xml_node_get_attr (node, "code"), NULL, 10);
+  } else {
+    node = rest_xml_node_find (root, "token");
+    if (node && node->content)
+      sink += strlen (node->content);
+    node = rest_xml_node_find (root, "user");
+    if (node)
+      sink += strlen (rest_xml_node_get_attr (node, "username") ?: "");
+  }
+
+  rest_xml_node_unref (root);
+}
+
+/* Returns the microseconds taken per parse of @payload */
+static double
+time_stream (const char *payload)
+{
+  GTimer *timer;
+  double elapsed;
+  int i;
+
+  timer = g_timer_new ();
+  for (i = 0; i < opt_iterations; i++)
+    parse_stream (payload);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  return elapsed * G_USEC_PER_SEC / opt_iterations;
+}
+
+static double
+time_tree (const char *payload)
+{
+  RestXmlParser *parser;
+  GTimer *timer;
+  double elapsed;
+  int i;
+
+  parser = rest_xml_parser_new ();
+
+  timer = g_timer_new ();
+  for (i = 0; i < opt_iterations; i++)
+    parse_tree (parser, payload);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  g_object_unref (parser);
+
+  return elapsed * G_USEC_PER_SEC / opt_iterations;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  guint i;
+
+  g_type_init ();
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_iterations <= 0) {
+    g_printerr ("The number of iterations must be positive\n");
+    return 1;
+  }
+
+  g_print ("{\n  \"benchmark\": \"flickr-parse\",\n  \"iterations\": %d,\n  \"results\": [\n",
+           opt_iterations);
+
+  for (i = 0; i < G_N_ELEMENTS (responses); i++) {
+    /* Warm up the allocator and the caches before timing */
+    parse_stream (responses[i].payload);
+
+    g_print ("    { \"response\": \"%s\", \"stream_us\": %.3f, \"tree_us\": %.3f }%s\n",
+             responses[i].name,
+             time_stream (responses[i].payload),
+             time_tree (responses[i].payload),
+             i + 1 < G_N_ELEMENTS (responses) ? "," : "");
+  }
+
+  g_print ("  ]\n}\n");
+
+  return 0;
+}
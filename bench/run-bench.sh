@@ -0,0 +1,145 @@
+#!/bin/sh
+#
+# Copyright (C) 2010 Intel Corporation.
+#
+# This program is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 2 of the License, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+# details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <http://www.gnu.org/licenses/>.
+
+# Runs bisho-bench against local stand-ins for everything bisho talks to: an
+# Xvfb display, a private session bus with fake-socialweb and fake-secrets on
+# it, and oauth-stub for the OAuth services.  HOME and the XDG directories
+# point at a temporary directory, so nothing of the user's is read or changed.
+# The results of every run, and of expander-bench which needs the display too,
+# are printed as one JSON report.
+#
+# Settings come from the environment:
+#   BENCHDIR        where the benchmark programs were built (.)
+#   MODULEDIR       where the panes were built ($BENCHDIR/../panes/.libs)
+#   RUNS            number of times to start bisho-bench (5)
+#   SERVICES        number of user name and password services (20)
+#   OAUTH_SERVICES  number of OAuth services (2)
+#   LOGINS          number of OAuth logins in each run (5)
+#   FLOW            OAuth flow of the stub, 1.0, 1.0a-oob or 1.0a (1.0a-oob)
+#   VERSION         the version named in the report
+
+set -e
+
+BENCHDIR=$(cd "${BENCHDIR:-.}" && pwd)
+MODULEDIR=${MODULEDIR:-$BENCHDIR/../panes/.libs}
+RUNS=${RUNS:-5}
+SERVICES=${SERVICES:-20}
+OAUTH_SERVICES=${OAUTH_SERVICES:-2}
+LOGINS=${LOGINS:-5}
+FLOW=${FLOW:-1.0a-oob}
+VERSION=${VERSION:-unknown}
+VERIFIER=bench-verifier
+
+tmp=$(mktemp -d)
+pids=
+
+cleanup () {
+    for pid in $pids; do
+        kill "$pid" 2>/dev/null || true
+    done
+    if [ -n "$DBUS_SESSION_BUS_PID" ]; then
+        kill "$DBUS_SESSION_BUS_PID" 2>/dev/null || true
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+fail () {
+    echo "run-bench: $*" >&2
+    exit 1
+}
+
+# Wait up to ten seconds for the command given to succeed
+wait_for () {
+    tries=0
+    until "$@"; do
+        tries=$((tries + 1))
+        [ $tries -lt 100 ] || return 1
+        sleep 0.1
+    done
+}
+
+has_owner () {
+    dbus-send --session --print-reply --dest=org.freedesktop.DBus \
+        /org/freedesktop/DBus org.freedesktop.DBus.NameHasOwner string:"$1" 2>/dev/null \
+        | grep -q "boolean true"
+}
+
+export HOME="$tmp/home"
+export XDG_DATA_HOME="$tmp/data"
+export XDG_CONFIG_HOME="$tmp/config"
+export XDG_CACHE_HOME="$tmp/cache"
+# With no other data directories gtk_show_uri() finds no browser to start
+export XDG_DATA_DIRS="$tmp/data"
+export XDG_CONFIG_DIRS="$tmp/config"
+export LANGUAGE=C
+mkdir -p "$HOME" "$XDG_DATA_HOME" "$XDG_CONFIG_HOME" "$XDG_CACHE_HOME"
+
+display=99
+while [ -e /tmp/.X$display-lock ]; do
+    display=$((display + 1))
+done
+Xvfb :$display -screen 0 1024x768x24 -nolisten tcp >/dev/null 2>&1 &
+pids="$pids $!"
+export DISPLAY=:$display
+wait_for test -S /tmp/.X11-unix/X$display || fail "Xvfb did not start"
+
+eval "$(dbus-launch --sh-syntax)"
+[ -n "$DBUS_SESSION_BUS_ADDRESS" ] || fail "cannot start a session bus"
+
+# The stub writes its descriptors before fake-socialweb reads them
+"$BENCHDIR/oauth-stub" --data-dir "$XDG_DATA_HOME" --services "$OAUTH_SERVICES" \
+    --flow "$FLOW" --auto-authorize --verifier "$VERIFIER" >"$tmp/port" &
+pids="$pids $!"
+wait_for test -s "$tmp/port" || fail "oauth-stub did not start"
+
+"$BENCHDIR/fake-socialweb" --data-dir "$XDG_DATA_HOME" --services "$SERVICES" &
+pids="$pids $!"
+"$BENCHDIR/fake-secrets" &
+pids="$pids $!"
+wait_for has_owner org.gnome.libsocialweb || fail "fake-socialweb did not start"
+wait_for has_owner org.freedesktop.secrets || fail "fake-secrets did not start"
+
+if [ "$FLOW" = "1.0" ]; then
+    verifier=
+else
+    verifier="--verifier=$VERIFIER"
+fi
+
+status=0
+runs=
+
+expander=$("$BENCHDIR/expander-bench") || status=1
+[ -n "$expander" ] || expander="null"
+
+for run in $(seq "$RUNS"); do
+    # Every run starts from the same empty cache
+    rm -rf "$XDG_CACHE_HOME/bisho"
+
+    result=$("$BENCHDIR/bisho-bench" --exec-time=$(($(date +%s%N) / 1000)) \
+        --module-dir="$MODULEDIR" --logins="$LOGINS" $verifier) || status=1
+    [ -n "$result" ] || result="null"
+
+    runs="$runs${runs:+,
+    }$result"
+done
+
+printf '{\n  "version": "%s",\n  "services": %d,\n  "runs": [\n    %s\n  ],\n  "expander": %s\n}\n' \
+    "$VERSION" $((SERVICES + OAUTH_SERVICES)) "$runs" "$expander"
+
+exit $status
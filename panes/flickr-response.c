@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads the frob, token and user name from the responses to the Flickr auth
+ * calls in a single pass, without building a tree.  Nothing is shared between
+ * calls, so this is safe to use from worker threads.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib/gi18n-lib.h>
+#include <rest/rest-proxy.h>
+#include "flickr-response.h"
+
+/* State while parsing a response */
+typedef struct {
+  FlickrResponse *response;
+  int depth;
+  gboolean ok;
+  char *message;
+  /* The frob or token element being read */
+  char **target;
+  GString *text;
+  char *fullname;
+  char *username;
+} ResponseParser;
+
+static const char *
+find_attribute (const char *name, const char **names, const char **values)
+{
+  int i;
+
+  for (i = 0; names[i]; i++) {
+    if (strcmp (names[i], name) == 0)
+      return values[i];
+  }
+
+  return NULL;
+}
+
+static void
+response_start_element (GMarkupParseContext *context,
+                        const char          *element_name,
+                        const char         **attribute_names,
+                        const char         **attribute_values,
+                        gpointer             user_data,
+                        GError             **error)
+{
+  ResponseParser *parser = user_data;
+
+  if (parser->depth++ == 0) {
+    if (strcmp (element_name, "rsp") != 0) {
+      g_set_error (error, REST_PROXY_ERROR, REST_PROXY_ERROR_FAILED,
+                   _("Unexpected response from Flickr"));
+      return;
+    }
+    parser->ok = g_strcmp0 (find_attribute ("stat", attribute_names, attribute_values), "ok") == 0;
+  } else if (strcmp (element_name, "err") == 0) {
+    const char *code;
+
+    code = find_attribute ("code", attribute_names, attribute_values);
+    if (code)
+      parser->response->error_code = g_ascii_strtoll (code, NULL, 10);
+    g_free (parser->message);
+    parser->message = g_strdup (find_attribute ("msg", attribute_names, attribute_values));
+  } else if (strcmp (element_name, "frob") == 0) {
+    parser->target = &parser->response->frob;
+    g_string_truncate (parser->text, 0);
+  } else if (strcmp (element_name, "token") == 0) {
+    parser->target = &parser->response->token;
+    g_string_truncate (parser->text, 0);
+  } else if (strcmp (element_name, "user") == 0) {
+    g_free (parser->fullname);
+    g_free (parser->username);
+    parser->fullname = g_strdup (find_attribute ("fullname", attribute_names, attribute_values));
+    parser->username = g_strdup (find_attribute ("username", attribute_names, attribute_values));
+  }
+}
+
+static void
+response_end_element (GMarkupParseContext *context,
+                      const char          *element_name,
+                      gpointer             user_data,
+                      GError             **error)
+{
+  ResponseParser *parser = user_data;
+
+  parser->depth--;
+
+  if (parser->target) {
+    g_free (*parser->target);
+    *parser->target = g_strdup (parser->text->str);
+    parser->target = NULL;
+  }
+}
+
+static void
+response_text (GMarkupParseContext *context,
+               const char          *text,
+               gsize                text_len,
+               gpointer             user_data,
+               GError             **error)
+{
+  ResponseParser *parser = user_data;
+
+  if (parser->target)
+    g_string_append_len (parser->text, text, text_len);
+}
+
+static const GMarkupParser response_parser = {
+  response_start_element,
+  response_end_element,
+  response_text,
+  NULL,
+  NULL
+};
+
+/*
+ * Parse @length bytes of @payload (or up to the nul if @length is -1), setting
+ * the frob, token and user name in @response from whichever of them it
+ * contains.  Returns FALSE if the response couldn't be parsed or is an error,
+ * in which case the error code from Flickr (if any) is left in @response.
+ */
+gboolean
+flickr_response_parse (const char *payload, gssize length,
+                       FlickrResponse *response, GError **error)
+{
+  ResponseParser parser = { NULL, };
+  GMarkupParseContext *context;
+  GError *parse_error = NULL;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (response, FALSE);
+
+  parser.response = response;
+  parser.text = g_string_new (NULL);
+
+  context = g_markup_parse_context_new (&response_parser, 0, &parser, NULL);
+  if (payload == NULL ||
+      !g_markup_parse_context_parse (context, payload, length, &parse_error) ||
+      !g_markup_parse_context_end_parse (context, &parse_error)) {
+    if (parse_error && parse_error->domain == REST_PROXY_ERROR) {
+      g_propagate_error (error, parse_error);
+    } else {
+      g_clear_error (&parse_error);
+      g_set_error (error, REST_PROXY_ERROR, REST_PROXY_ERROR_FAILED,
+                   _("Invalid response from Flickr"));
+    }
+    goto done;
+  }
+
+  if (!parser.ok) {
+    g_set_error (error, REST_PROXY_ERROR, REST_PROXY_ERROR_FAILED,
+                 _("Error from Flickr: %s"),
+                 parser.message ? parser.message : _("Unknown error"));
+    goto done;
+  }
+
+  g_free (response->user_name);
+  if (parser.fullname && parser.fullname[0] != '\0')
+    response->user_name = g_strdup (parser.fullname);
+  else
+    response->user_name = g_strdup (parser.username);
+
+  ret = TRUE;
+
+ done:
+  g_markup_parse_context_free (context);
+  g_string_free (parser.text, TRUE);
+  g_free (parser.message);
+  g_free (parser.fullname);
+  g_free (parser.username);
+
+  return ret;
+}
+
+/* Free the fields of @response and reset them, so that it can be reused */
+void
+flickr_response_clear (FlickrResponse *response)
+{
+  g_return_if_fail (response);
+
+  g_free (response->frob);
+  g_free (response->token);
+  g_free (response->user_name);
+  memset (response, 0, sizeof (FlickrResponse));
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLICKR_RESPONSE_H__
+#define __FLICKR_RESPONSE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The fields read from a Flickr auth response */
+typedef struct {
+  char *frob;
+  char *token;
+  char *user_name;
+  /* The code of the error Flickr returned, or 0 */
+  int error_code;
+} FlickrResponse;
+
+gboolean flickr_response_parse (const char *payload, gssize length,
+                                FlickrResponse *response, GError **error);
+
+void flickr_response_clear (FlickrResponse *response);
+
+G_END_DECLS
+
+#endif /* __FLICKR_RESPONSE_H__ */
@@ -18,16 +18,19 @@
  */
 
 #include <config.h>
+#include <time.h>
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
 #include <gnome-keyring.h>
 #include <libsoup/soup.h>
 #include <rest-extras/flickr-proxy.h>
-#include <rest/rest-xml-parser.h>
 #include <libsocialweb-keystore/sw-keystore.h>
 #include "service-info.h"
 #include "bisho-module.h"
 #include "bisho-utils.h"
+#include "bisho-trace.h"
+#include "bisho-scheduler.h"
+#include "flickr-response.h"
 /* TODO: merge */
 #include "flickr.h"
 
@@ -41,7 +44,7 @@ static const GnomeKeyringPasswordSchema flickr_schema = {
   }
 };
 
-#define FLICKR_SERVER "http://flickr.com/"
+#define FLICKR_SERVER BISHO_CREDENTIALS_FLICKR_SERVER
 
 struct _BishoPaneFlickrPrivate {
   const char *api_key;
@@ -50,11 +53,21 @@ struct _BishoPaneFlickrPrivate {
   GtkWidget *button;
   gchar *frob;
   char *user_name;
+  /* The call in flight, if any */
+  RestProxyCall *call;
+  /* Set from the start of a call until its response has been handled,
+     including the parse in a worker thread */
+  gboolean busy;
+  /* Cancelled when the pane is destroyed */
+  GCancellable *cancellable;
+  int state; /* The ButtonState shown, or -1 */
 };
 
 typedef enum {
   LOGGED_OUT,
   WORKING,
+  /* Waiting for the user to authorise the frob in their browser */
+  AUTHORIZING,
   LOGGED_IN,
 } ButtonState;
 
@@ -63,80 +76,396 @@ G_DEFINE_DYNAMIC_TYPE (BishoPaneFlickr, bisho_pane_flickr, BISHO_TYPE_PANE);
 
 static void update_widgets (BishoPaneFlickr *data, ButtonState state);
 
-static RestXmlNode *
-get_xml (RestProxyCall *call)
+/* The Flickr error code for an unknown or revoked token */
+#define FLICKR_ERROR_INVALID_TOKEN 98
+
+/* State carried between the network callbacks and the worker threads */
+typedef struct {
+  RestProxyCall *call;
+  FlickrResponse response;
+} FlickrOp;
+
+static FlickrOp *
+flickr_op_new (RestProxyCall *call)
+{
+  FlickrOp *op;
+
+  op = g_slice_new0 (FlickrOp);
+  op->call = call;
+
+  return op;
+}
+
+static void
+flickr_op_free (FlickrOp *op)
+{
+  g_object_unref (op->call);
+  flickr_response_clear (&op->response);
+  g_slice_free (FlickrOp, op);
+}
+
+/*
+ * The result of checkToken is cached, keyed by a hash of the token, so that
+ * showing the pane doesn't cost a round trip to Flickr every time.  Entries
+ * older than the TTL are still shown, but checked again in the background.
+ */
+
+/* Seconds a checkToken result is trusted for, unless BISHO_FLICKR_TOKEN_TTL
+   is set */
+#define TOKEN_CACHE_TTL (24 * 60 * 60)
+
+static char *
+get_token_cache_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "bisho", "flickr-tokens.ini", NULL);
+}
+
+static gint64
+get_token_cache_ttl (void)
+{
+  const char *s;
+
+  s = g_getenv ("BISHO_FLICKR_TOKEN_TTL");
+  if (s && s[0])
+    return g_ascii_strtoll (s, NULL, 10);
+
+  return TOKEN_CACHE_TTL;
+}
+
+/* The cache is read once, in a worker thread started when the first pane is
+   built, and written from a low priority idle.  The key file is only touched
+   with the lock held. */
+G_LOCK_DEFINE_STATIC (token_cache);
+static GKeyFile *token_cache = NULL;
+static guint token_cache_save_id = 0;
+
+/* Returns the cache, reading it if needed, with the lock held */
+static GKeyFile *
+lock_token_cache (void)
+{
+  char *filename;
+
+  G_LOCK (token_cache);
+
+  if (token_cache == NULL) {
+    token_cache = g_key_file_new ();
+    filename = get_token_cache_filename ();
+    g_key_file_load_from_file (token_cache, filename, G_KEY_FILE_NONE, NULL);
+    g_free (filename);
+  }
+
+  return token_cache;
+}
+
+static void
+unlock_token_cache (void)
+{
+  G_UNLOCK (token_cache);
+}
+
+static gboolean
+load_token_cache_job (GIOSchedulerJob *job, GCancellable *cancellable, gpointer user_data)
+{
+  lock_token_cache ();
+  unlock_token_cache ();
+
+  return FALSE;
+}
+
+/*
+ * Start reading the cache in a worker thread, so that it is normally ready by
+ * the time the keyring returns the token.
+ */
+static void
+preload_token_cache (void)
+{
+  static gboolean started = FALSE;
+
+  if (started)
+    return;
+  started = TRUE;
+
+  g_io_scheduler_push_job (load_token_cache_job, NULL, NULL, G_PRIORITY_DEFAULT, NULL);
+}
+
+static gboolean
+save_token_cache_idle (gpointer user_data)
 {
-  static RestXmlParser *parser = NULL;
-  RestXmlNode *root;
+  char *filename, *dirname, *data;
+  GError *error = NULL;
+  gsize length;
 
-  if (parser == NULL)
-    parser = rest_xml_parser_new ();
+  token_cache_save_id = 0;
 
-  root = rest_xml_parser_parse_from_data (parser,
-                                          rest_proxy_call_get_payload (call),
-                                          rest_proxy_call_get_payload_length (call));
+  data = g_key_file_to_data (lock_token_cache (), &length, NULL);
+  unlock_token_cache ();
 
-  if (root == NULL) {
-    g_message ("Invalid XML from Flickr:\n%s",
-               rest_proxy_call_get_payload (call));
-    goto done;
+  filename = get_token_cache_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (filename, data, length, &error)) {
+    g_message ("Cannot write Flickr token cache: %s", error->message);
+    g_error_free (error);
   }
 
-  if (strcmp (root->name, "rsp") != 0) {
-    g_message ("Unexpected response from Flickr:\n%s",
-               rest_proxy_call_get_payload (call));
-    rest_xml_node_unref (root);
-    root = NULL;
-    goto done;
+  g_free (data);
+  g_free (filename);
+
+  return FALSE;
+}
+
+/*
+ * Returns TRUE if @token was valid when last checked, setting @user_name and
+ * whether the check has @expired.
+ */
+static gboolean
+token_cache_lookup (const char *token, char **user_name, gboolean *expired)
+{
+  GKeyFile *keys;
+  char *hash, *checked;
+  gboolean found;
+
+  keys = lock_token_cache ();
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, token, -1);
+
+  found = g_key_file_has_group (keys, hash);
+  if (found) {
+    checked = g_key_file_get_value (keys, hash, "Checked", NULL);
+    *user_name = g_key_file_get_string (keys, hash, "UserName", NULL);
+    *expired = checked == NULL ||
+      time (NULL) - g_ascii_strtoll (checked, NULL, 10) >= get_token_cache_ttl ();
+    g_free (checked);
+  }
+
+  unlock_token_cache ();
+  g_free (hash);
+
+  return found;
+}
+
+/* Remember that @token is valid, or forget it if @valid is FALSE */
+static void
+token_cache_update (const char *token, gboolean valid, const char *user_name)
+{
+  GKeyFile *keys;
+  char *hash, *checked;
+
+  if (token == NULL)
+    return;
+
+  keys = lock_token_cache ();
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, token, -1);
+
+  if (valid) {
+    checked = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64)time (NULL));
+    g_key_file_set_value (keys, hash, "Checked", checked);
+    g_free (checked);
+
+    if (user_name)
+      g_key_file_set_string (keys, hash, "UserName", user_name);
+    else
+      g_key_file_remove_key (keys, hash, "UserName", NULL);
+  } else {
+    g_key_file_remove_group (keys, hash, NULL);
   }
 
-  if (strcmp (rest_xml_node_get_attr (root, "stat"), "ok") != 0) {
-    RestXmlNode *node;
-    const char *msg;
+  unlock_token_cache ();
+  g_free (hash);
 
-    node = rest_xml_node_find (root, "err");
-    msg = rest_xml_node_get_attr (node, "msg");
+  if (token_cache_save_id == 0)
+    token_cache_save_id = g_idle_add_full (G_PRIORITY_LOW, save_token_cache_idle, NULL, NULL);
+}
 
-    /* TODO bisho_utils_message (NULL, "Flickr", msg); */
-    g_message ("Error from Flickr: %s", msg);
+/*
+ * Read the response to the call in @op into @op->response.  Returns FALSE if
+ * the response couldn't be parsed or is an error.
+ */
+static gboolean
+parse_response (FlickrOp *op, GError **error)
+{
+  GError *parse_error = NULL;
+  const char *payload;
+
+  payload = rest_proxy_call_get_payload (op->call);
 
-    rest_xml_node_unref (root);
-    root = NULL;
-    goto done;
+  if (!flickr_response_parse (payload, rest_proxy_call_get_payload_length (op->call),
+                              &op->response, &parse_error)) {
+    g_message ("%s:\n%s", parse_error->message, payload);
+    g_propagate_error (error, parse_error);
+    return FALSE;
   }
 
-  done:
-  g_object_unref (call);
-  return root;
+  return TRUE;
 }
 
+/*
+ * Hand the response in @op to @func in a worker thread, and call @callback in
+ * the main loop when it is done.  The operation is cancelled with the pane.
+ */
 static void
-log_in_clicked (GtkWidget *button, gpointer user_data)
+run_in_thread (BishoPaneFlickr *pane,
+               FlickrOp *op,
+               GSimpleAsyncThreadFunc func,
+               GAsyncReadyCallback callback)
+{
+  GSimpleAsyncResult *result;
+
+  result = g_simple_async_result_new (G_OBJECT (pane), callback, NULL, func);
+  g_simple_async_result_set_op_res_gpointer (result, op, (GDestroyNotify)flickr_op_free);
+  g_simple_async_result_run_in_thread (result, func, G_PRIORITY_DEFAULT,
+                                       pane->priv->cancellable);
+  g_object_unref (result);
+}
+
+/*
+ * Returns the result of a run_in_thread() operation, or NULL on failure.  If
+ * the pane has been destroyed in the meantime, the error is not reported.
+ */
+static FlickrOp *
+finish_in_thread (BishoPaneFlickr *pane, GAsyncResult *res, GError **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (res);
+
+  /* The response has been handled, so the next step can start */
+  pane->priv->busy = FALSE;
+
+  if (g_cancellable_is_cancelled (pane->priv->cancellable))
+    return NULL;
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  return g_simple_async_result_get_op_res_gpointer (simple);
+}
+
+/*
+ * Start @call through the scheduler, taking ownership of it.  Only one call is
+ * in flight at once, and the pane is busy until its response has been handled.
+ * Failures, including timeouts, are reported to @callback.
+ */
+static void
+start_call (BishoPaneFlickr *pane, RestProxyCall *call, gboolean idempotent,
+            RestProxyCallAsyncCallback callback)
+{
+  pane->priv->busy = TRUE;
+  pane->priv->call = call;
+  bisho_scheduler_call_async (call, 0, idempotent, callback, G_OBJECT (pane), NULL);
+}
+
+/*
+ * Take back ownership of the call started with start_call().  Returns FALSE if
+ * the pane has been destroyed, in which case the callback should do nothing.
+ * The pane stays busy until the response has been parsed, or the callback
+ * fails.
+ */
+static gboolean
+end_call (BishoPaneFlickr *pane)
 {
-  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
   BishoPaneFlickrPrivate *priv = pane->priv;
-  char *frob, *url;
-  RestProxyCall *call;
-  RestXmlNode *root;
 
-  update_widgets (pane, WORKING);
+  if (g_cancellable_is_cancelled (priv->cancellable))
+    return FALSE;
 
-  call = rest_proxy_new_call (priv->proxy);
-  rest_proxy_call_set_function (call, "flickr.auth.getFrob");
+  priv->call = NULL;
+  return TRUE;
+}
 
-  if (!rest_proxy_call_sync (call, NULL))
-    g_error ("Cannot get frob");
+static void
+get_frob_thread (GSimpleAsyncResult *result, GObject *object, GCancellable *cancellable)
+{
+  FlickrOp *op = g_simple_async_result_get_op_res_gpointer (result);
+  GError *error = NULL;
 
-  root = get_xml (call);
-  priv->frob = g_strdup (rest_xml_node_find (root, "frob")->content);
-  rest_xml_node_unref (root);
+  if (!parse_response (op, &error)) {
+    g_simple_async_result_set_from_error (result, error);
+    g_error_free (error);
+    return;
+  }
+
+  if (op->response.frob == NULL)
+    g_simple_async_result_set_error (result, REST_PROXY_ERROR, REST_PROXY_ERROR_FAILED,
+                                     _("Unexpected response from Flickr"));
+}
+
+static void
+get_frob_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (source);
+  BishoPaneFlickrPrivate *priv = pane->priv;
+  GError *error = NULL;
+  FlickrOp *op;
+  char *url;
+
+  op = finish_in_thread (pane, res, &error);
+  if (op == NULL) {
+    if (error) {
+      bisho_pane_set_banner_error (BISHO_PANE (pane), error);
+      g_message ("Cannot get frob: %s", error->message);
+      g_error_free (error);
+      update_widgets (pane, LOGGED_OUT);
+    }
+    return;
+  }
+
+  g_free (priv->frob);
+  priv->frob = op->response.frob;
+  op->response.frob = NULL;
+
+  update_widgets (pane, AUTHORIZING);
 
   /* We need write permissions since lsw supports uploading */
   url = flickr_proxy_build_login_url (FLICKR_PROXY (priv->proxy),
                                       priv->frob,
                                       "write");
 
-  gtk_show_uri (gtk_widget_get_screen (GTK_WIDGET (button)), url, GDK_CURRENT_TIME, NULL);
+  gtk_show_uri (gtk_widget_get_screen (priv->button), url, GDK_CURRENT_TIME, NULL);
+  g_free (url);
+}
+
+static void
+get_frob_cb (RestProxyCall *call, const GError *error, GObject *weak_object, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (weak_object);
+
+  bisho_trace_async_end ("flickr_get_frob", pane, NULL);
+
+  if (!end_call (pane))
+    return;
+
+  if (error) {
+    bisho_pane_set_banner_error (BISHO_PANE (pane), error);
+    g_message ("Cannot get frob: %s", error->message);
+    g_object_unref (call);
+    pane->priv->busy = FALSE;
+    update_widgets (pane, LOGGED_OUT);
+    return;
+  }
+
+  run_in_thread (pane, flickr_op_new (call), get_frob_thread, get_frob_done);
+}
+
+static void
+log_in_clicked (GtkWidget *button, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
+  BishoPaneFlickrPrivate *priv = pane->priv;
+  RestProxyCall *call;
+
+  if (priv->busy)
+    return;
+
+  update_widgets (pane, WORKING);
+
+  /* getFrob must not be signed with an old token */
+  flickr_proxy_set_token (FLICKR_PROXY (priv->proxy), NULL);
+
+  call = rest_proxy_new_call (priv->proxy);
+  rest_proxy_call_set_function (call, "flickr.auth.getFrob");
+
+  start_call (pane, call, TRUE, get_frob_cb);
+  bisho_trace_async_begin ("flickr_get_frob", pane, NULL);
 }
 
 
@@ -146,10 +475,13 @@ delete_done_cb (GnomeKeyringResult result, gpointer user_data)
   BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
   SwClientService *service;
 
+  bisho_trace_async_end ("keyring_delete", pane, "flickr");
+
   if (result == GNOME_KEYRING_RESULT_OK){
     update_widgets (pane, LOGGED_OUT);
     service = sw_client_get_service (BISHO_PANE (pane)->socialweb, BISHO_PANE (pane)->info->name);
     sw_client_service_credentials_updated (service);
+    bisho_utils_reload_accounts ();
   }
   else
     update_widgets (pane, LOGGED_IN);
@@ -161,6 +493,14 @@ log_out_clicked (GtkButton *button, gpointer user_data)
   BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
   BishoPaneFlickrPrivate *priv = pane->priv;
 
+  /* The token is being checked, and the result would log back in */
+  if (button && priv->busy)
+    return;
+
+  token_cache_update (flickr_proxy_get_token (FLICKR_PROXY (priv->proxy)), FALSE, NULL);
+  flickr_proxy_set_token (FLICKR_PROXY (priv->proxy), NULL);
+
+  bisho_trace_async_begin ("keyring_delete", pane, "flickr");
   gnome_keyring_delete_password (&flickr_schema, delete_done_cb, user_data, NULL,
                                  "server", FLICKR_SERVER,
                                  "api-key", priv->api_key,
@@ -170,41 +510,128 @@ log_out_clicked (GtkButton *button, gpointer user_data)
 }
 
 static void
-got_auth (RestXmlNode *node, BishoPaneFlickr *pane)
+got_auth (BishoPaneFlickr *pane, const char *name)
 {
-  RestXmlNode *user;
-  const char *name;
-
-  user = rest_xml_node_find (node, "user");
-  name = rest_xml_node_get_attr (user, "fullname");
-  if (name == NULL || name[0] == '\0')
-    name = rest_xml_node_get_attr (user, "username");
-
   g_free (pane->priv->user_name);
   pane->priv->user_name = g_strdup (name);
 
   update_widgets (pane, LOGGED_IN);
 }
 
+static void
+get_token_thread (GSimpleAsyncResult *result, GObject *object, GCancellable *cancellable)
+{
+  FlickrOp *op = g_simple_async_result_get_op_res_gpointer (result);
+  GError *error = NULL;
+
+  if (!parse_response (op, &error)) {
+    g_simple_async_result_set_from_error (result, error);
+    g_error_free (error);
+    return;
+  }
+
+  if (op->response.token == NULL)
+    g_simple_async_result_set_error (result, REST_PROXY_ERROR, REST_PROXY_ERROR_FAILED,
+                                     _("Unexpected response from Flickr"));
+}
+
+static void
+store_done_cb (GnomeKeyringResult result, guint32 item_id, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
+  SwClientService *service;
+
+  if (g_cancellable_is_cancelled (pane->priv->cancellable)) {
+    g_object_unref (pane);
+    return;
+  }
+
+  if (result == GNOME_KEYRING_RESULT_OK) {
+    update_widgets (pane, LOGGED_IN);
+    service = sw_client_get_service (BISHO_PANE (pane)->socialweb, BISHO_PANE (pane)->info->name);
+    sw_client_service_credentials_updated (service);
+    bisho_utils_reload_accounts ();
+  } else {
+    g_message ("Cannot update keyring: %s", gnome_keyring_result_to_message (result));
+    update_widgets (pane, LOGGED_OUT);
+  }
+
+  g_object_unref (pane);
+}
+
+static void
+get_token_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (source);
+  BishoPaneFlickrPrivate *priv = pane->priv;
+  GError *error = NULL;
+  FlickrOp *op;
+
+  op = finish_in_thread (pane, res, &error);
+  if (op == NULL) {
+    if (error) {
+      bisho_pane_set_banner_error (BISHO_PANE (pane), error);
+      g_message ("Cannot get token: %s", error->message);
+      g_error_free (error);
+      update_widgets (pane, LOGGED_OUT);
+    }
+    return;
+  }
+
+  flickr_proxy_set_token (FLICKR_PROXY (priv->proxy), op->response.token);
+  token_cache_update (op->response.token, TRUE, op->response.user_name);
+
+  g_free (priv->user_name);
+  priv->user_name = op->response.user_name;
+  op->response.user_name = NULL;
+
+  bisho_credentials_store_password (bisho_pane_get_credentials (BISHO_PANE (pane)),
+                                    BISHO_PANE (pane)->info->display_name,
+                                    FLICKR_SERVER,
+                                    "api-key", priv->api_key,
+                                    op->response.token,
+                                    store_done_cb, g_object_ref (pane));
+}
+
+static void
+get_token_cb (RestProxyCall *call, const GError *error, GObject *weak_object, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (weak_object);
+
+  bisho_trace_async_end ("flickr_get_token", pane, NULL);
+
+  if (!end_call (pane))
+    return;
+
+  if (error) {
+    bisho_pane_set_banner_error (BISHO_PANE (pane), error);
+    g_message ("Cannot get token: %s", error->message);
+    g_object_unref (call);
+    pane->priv->busy = FALSE;
+    update_widgets (pane, LOGGED_OUT);
+    return;
+  }
+
+  run_in_thread (pane, flickr_op_new (call), get_token_thread, get_token_done);
+}
+
 static void
 bisho_pane_flickr_continue_auth (BishoPane *_pane, GHashTable *params)
 {
   BishoPaneFlickr *pane = BISHO_PANE_FLICKR (_pane);
   BishoPaneFlickrPrivate *priv = pane->priv;
-  ServiceInfo *info = BISHO_PANE (pane)->info;
-  SwClientService *service;
   RestProxyCall *call;
-  RestXmlNode *node;
-  const char *token;
-  GError *error = NULL;
   const gchar *frob;
 
+  /* Still getting the frob, or already exchanging it */
+  if (priv->busy)
+    return;
+
   if (params == NULL || g_hash_table_lookup (params, "frob") == NULL) {
     if (!priv->frob)
     {
+      /* Leave the pane as it is, as nothing was waiting for this */
       g_message ("Frob not provided in callback, cannot continue");
-      /* TODO bisho_utils_message (NULL, "Flickr", NULL); */
-      update_widgets (pane, LOGGED_OUT);
       return;
     } else {
       frob = priv->frob;
@@ -219,60 +646,12 @@ bisho_pane_flickr_continue_auth (BishoPane *_pane, GHashTable *params)
   rest_proxy_call_set_function (call, "flickr.auth.getToken");
   rest_proxy_call_add_param (call, "frob", frob);
 
-  if (priv->frob)
-  {
-    g_free (priv->frob);
-    frob = NULL;
-  }
-
-  if (!rest_proxy_call_sync (call, &error)) {
-    bisho_pane_set_banner_error (BISHO_PANE (pane), error);
-    g_message ("Cannot get token: %s", error->message);
-    g_error_free (error);
-    update_widgets (pane, LOGGED_OUT);
-    return;
-  }
-
-  node = get_xml (call);
-
-  if (node == NULL) {
-    update_widgets (pane, LOGGED_OUT);
-    return;
-  }
-
-  token = rest_xml_node_find (node, "token")->content;
-  flickr_proxy_set_token (FLICKR_PROXY (priv->proxy), token);
-
-  got_auth (node, pane);
-
-  /* TODO async */
-  GnomeKeyringResult result;
-  GnomeKeyringAttributeList *attrs;
-  guint32 id;
-  attrs = gnome_keyring_attribute_list_new ();
-  gnome_keyring_attribute_list_append_string (attrs, "server", FLICKR_SERVER);
-  gnome_keyring_attribute_list_append_string (attrs, "api-key", priv->api_key);
-
-  result = gnome_keyring_item_create_sync (NULL,
-                                           GNOME_KEYRING_ITEM_GENERIC_SECRET,
-                                           info->display_name,
-                                           attrs, token,
-                                           TRUE, &id);
-
-  if (result == GNOME_KEYRING_RESULT_OK) {
-    gnome_keyring_item_grant_access_rights_sync (NULL,
-                                                 "libsocialweb",
-                                                 LIBEXECDIR "/libsocialweb-core",
-                                                 id, GNOME_KEYRING_ACCESS_READ);
-  } else {
-    g_message ("Cannot update keyring: %s", gnome_keyring_result_to_message (result));
-    update_widgets (pane, LOGGED_OUT);
-  }
-
-  rest_xml_node_unref (node);
+  g_free (priv->frob);
+  priv->frob = NULL;
 
-  service = sw_client_get_service (BISHO_PANE (pane)->socialweb, info->name);
-  sw_client_service_credentials_updated (service);
+  /* The frob can only be exchanged once */
+  start_call (pane, call, FALSE, get_token_cb);
+  bisho_trace_async_begin ("flickr_get_token", pane, NULL);
 }
 
 static void
@@ -286,12 +665,23 @@ update_widgets (BishoPaneFlickr *pane, ButtonState state)
 {
   BishoPaneFlickrPrivate *priv = pane->priv;
 
+  /* Confirming the cached state shouldn't disturb the pane */
+  if ((int)state == priv->state) {
+    if (state == LOGGED_IN) {
+      bisho_pane_set_user (BISHO_PANE (pane), NULL, priv->user_name);
+      bisho_pane_set_cached_state (BISHO_PANE (pane), TRUE, NULL, priv->user_name);
+    }
+    return;
+  }
+  priv->state = state;
+
   g_signal_handlers_disconnect_by_func (priv->button, log_out_clicked, pane);
   g_signal_handlers_disconnect_by_func (priv->button, log_in_clicked, pane);
   g_signal_handlers_disconnect_by_func (priv->button, continue_clicked, pane);
 
   switch (state) {
   case LOGGED_OUT:
+    bisho_pane_set_cached_state (BISHO_PANE (pane), FALSE, NULL, NULL);
     bisho_pane_set_user (BISHO_PANE (pane), NULL, NULL);
     bisho_pane_set_banner (BISHO_PANE (pane), NULL);
     gtk_widget_show (priv->button);
@@ -299,11 +689,18 @@ update_widgets (BishoPaneFlickr *pane, ButtonState state)
     g_signal_connect (priv->button, "clicked", G_CALLBACK (log_in_clicked), pane);
     break;
   case WORKING:
+    /* Nothing to click until the call is done */
     bisho_pane_set_banner (BISHO_PANE (pane), _("Connecting..."));
+    gtk_widget_hide (priv->button);
+    break;
+  case AUTHORIZING:
+    bisho_pane_set_banner (BISHO_PANE (pane), NULL);
+    gtk_widget_show (priv->button);
     gtk_button_set_label (GTK_BUTTON (priv->button), _("Continue"));
     g_signal_connect (priv->button, "clicked", G_CALLBACK (continue_clicked), pane);
     break;
   case LOGGED_IN:
+    bisho_pane_set_cached_state (BISHO_PANE (pane), TRUE, NULL, priv->user_name);
     bisho_pane_set_banner (BISHO_PANE (pane), _("Log in succeeded. You'll see new items in a couple of minutes."));
     bisho_pane_set_user (BISHO_PANE (pane), NULL, priv->user_name);
     gtk_widget_show (priv->button);
@@ -313,53 +710,113 @@ update_widgets (BishoPaneFlickr *pane, ButtonState state)
   }
 }
 
+static void
+check_token_thread (GSimpleAsyncResult *result, GObject *object, GCancellable *cancellable)
+{
+  FlickrOp *op = g_simple_async_result_get_op_res_gpointer (result);
+  GError *error = NULL;
+
+  if (!parse_response (op, &error)) {
+    g_simple_async_result_set_from_error (result, error);
+    g_error_free (error);
+  }
+}
+
+static void
+check_token_done (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (source);
+  GError *error = NULL;
+  FlickrOp *op;
+
+  op = finish_in_thread (pane, res, &error);
+  if (op == NULL) {
+    if (error == NULL)
+      return;
+
+    op = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (res));
+    if (op->response.error_code == FLICKR_ERROR_INVALID_TOKEN) {
+      /* The token isn't valid so fake a log out */
+      log_out_clicked (NULL, pane);
+    } else {
+      /* Can't tell if the token is still valid, so keep it */
+      bisho_pane_set_banner_error (BISHO_PANE (pane), error);
+      g_message ("Cannot check token: %s", error->message);
+    }
+    g_error_free (error);
+    bisho_pane_set_ready (BISHO_PANE (pane));
+    return;
+  }
+
+  token_cache_update (flickr_proxy_get_token (FLICKR_PROXY (pane->priv->proxy)),
+                      TRUE, op->response.user_name);
+
+  got_auth (pane, op->response.user_name);
+  bisho_pane_set_ready (BISHO_PANE (pane));
+}
+
 static void
 check_token_cb (RestProxyCall *call, const GError *error, GObject *weak_object, gpointer user_data)
 {
-  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
-  RestXmlNode *node;
+  BishoPaneFlickr *pane = BISHO_PANE_FLICKR (weak_object);
+
+  bisho_trace_async_end ("flickr_check_token", pane, NULL);
+
+  if (!end_call (pane))
+    return;
 
   if (error) {
     bisho_pane_set_banner_error (BISHO_PANE (pane), error);
     g_message ("Cannot check token: %s", error->message);
-  } else {
-    node = get_xml (call);
-    if (node) {
-      got_auth (node, pane);
-      rest_xml_node_unref (node);
-    } else {
-      /* The token isn't valid so fake a log out */
-      log_out_clicked (NULL, pane);
-    }
+    g_object_unref (call);
+    pane->priv->busy = FALSE;
+    bisho_pane_set_ready (BISHO_PANE (pane));
+    return;
   }
+
+  run_in_thread (pane, flickr_op_new (call), check_token_thread, check_token_done);
 }
 
 static void
-find_key_cb (GnomeKeyringResult result,
-             const char *string,
-             gpointer user_data)
+find_key_cb (GnomeKeyringResult  result,
+             guint32             item_id,
+             const char         *user,
+             const char         *secret,
+             gpointer            user_data)
 {
   BishoPaneFlickr *pane = BISHO_PANE_FLICKR (user_data);
   BishoPaneFlickrPrivate *priv = pane->priv;
 
+  bisho_trace_async_end ("keyring_find", pane, "flickr");
+
   if (result == GNOME_KEYRING_RESULT_OK) {
-    GError *error = NULL;
     RestProxyCall *call;
+    char *user_name = NULL;
+    gboolean expired;
+
+    flickr_proxy_set_token (FLICKR_PROXY (priv->proxy), secret);
 
-    flickr_proxy_set_token (FLICKR_PROXY (priv->proxy), string);
+    if (token_cache_lookup (secret, &user_name, &expired)) {
+      got_auth (pane, user_name);
+      g_free (user_name);
+
+      if (!expired) {
+        bisho_pane_set_ready (BISHO_PANE (pane));
+        return;
+      }
+    }
 
     call = rest_proxy_new_call (priv->proxy);
     rest_proxy_call_set_function (call, "flickr.auth.checkToken");
 
-    if (rest_proxy_call_async (call, check_token_cb, NULL, pane, &error)) {
+    start_call (pane, call, TRUE, check_token_cb);
+    bisho_trace_async_begin ("flickr_check_token", pane, NULL);
+    /* Keep showing the cached log in while the token is checked */
+    if (priv->state != LOGGED_IN)
       update_widgets (pane, WORKING);
-    } else {
-      bisho_pane_set_banner_error (BISHO_PANE (pane), error);
-      g_message ("Cannot check token: %s", error->message);
-      g_error_free (error);
-    }
   } else {
     update_widgets (pane, LOGGED_OUT);
+    bisho_pane_set_ready (BISHO_PANE (pane));
   }
 }
 
@@ -374,6 +831,7 @@ bisho_pane_flickr_constructed (GObject *object)
 {
   BishoPaneFlickr *pane = BISHO_PANE_FLICKR (object);
   BishoPaneFlickrPrivate *priv = pane->priv;
+  gboolean logged_in;
 
   bisho_pane_follow_connected (BISHO_PANE (pane), priv->button);
 
@@ -381,18 +839,63 @@ bisho_pane_flickr_constructed (GObject *object)
   if (!sw_keystore_get_key_secret ("flickr",
                                    &priv->api_key,
                                    &priv->shared_secret)) {
+    bisho_pane_set_ready (BISHO_PANE (pane));
     return;
   }
 
   priv->proxy = flickr_proxy_new (priv->api_key, priv->shared_secret);
   rest_proxy_set_user_agent (priv->proxy, "Bisho/" VERSION);
 
-  update_widgets (pane, WORKING);
+  /* Show the state from last time straight away, and then check it */
+  if (bisho_pane_get_cached_state (BISHO_PANE (pane), &logged_in, NULL, &priv->user_name)) {
+    update_widgets (pane, logged_in ? LOGGED_IN : LOGGED_OUT);
+    bisho_pane_set_banner (BISHO_PANE (pane), NULL);
+  } else {
+    update_widgets (pane, WORKING);
+  }
+
+  preload_token_cache ();
+
+  bisho_trace_async_begin ("keyring_find", pane, "flickr");
+  bisho_credentials_find_password (bisho_pane_get_credentials (BISHO_PANE (pane)),
+                                   FLICKR_SERVER,
+                                   "api-key", priv->api_key,
+                                   find_key_cb, pane);
+}
+
+static void
+bisho_pane_flickr_dispose (GObject *object)
+{
+  BishoPaneFlickrPrivate *priv = BISHO_PANE_FLICKR (object)->priv;
+
+  g_cancellable_cancel (priv->cancellable);
+
+  if (priv->call) {
+    RestProxyCall *call = priv->call;
+
+    priv->call = NULL;
+    bisho_scheduler_cancel (call);
+    g_object_unref (call);
+  }
+
+  if (priv->proxy) {
+    g_object_unref (priv->proxy);
+    priv->proxy = NULL;
+  }
+
+  G_OBJECT_CLASS (bisho_pane_flickr_parent_class)->dispose (object);
+}
 
-  gnome_keyring_find_password (&flickr_schema, find_key_cb, pane, NULL,
-                               "server", FLICKR_SERVER,
-                               "api-key", priv->api_key,
-                               NULL);
+static void
+bisho_pane_flickr_finalize (GObject *object)
+{
+  BishoPaneFlickrPrivate *priv = BISHO_PANE_FLICKR (object)->priv;
+
+  g_object_unref (priv->cancellable);
+  g_free (priv->frob);
+  g_free (priv->user_name);
+
+  G_OBJECT_CLASS (bisho_pane_flickr_parent_class)->finalize (object);
 }
 
 static void
@@ -402,6 +905,8 @@ bisho_pane_flickr_class_init (BishoPaneFlickrClass *klass)
   BishoPaneClass *pane_class = BISHO_PANE_CLASS (klass);
 
   o_class->constructed = bisho_pane_flickr_constructed;
+  o_class->dispose = bisho_pane_flickr_dispose;
+  o_class->finalize = bisho_pane_flickr_finalize;
   pane_class->get_auth_type = bisho_pane_flickr_get_auth_type;
   pane_class->continue_auth = bisho_pane_flickr_continue_auth;
 
@@ -422,6 +927,9 @@ bisho_pane_flickr_init (BishoPaneFlickr *pane)
   pane->priv = GET_PRIVATE (pane);
   priv = pane->priv;
 
+  priv->cancellable = g_cancellable_new ();
+  priv->state = -1;
+
   content = BISHO_PANE (pane)->content;
 
   align = gtk_alignment_new (0.5, 0.5, 0.0, 0.0);
@@ -23,10 +23,13 @@
 #include <gnome-keyring.h>
 #include <libsoup/soup.h>
 #include <rest/oauth-proxy.h>
+#include <rest/oauth-proxy-call.h>
 #include <libsocialweb-keystore/sw-keystore.h>
 #include "service-info.h"
 #include "bisho-module.h"
 #include "bisho-utils.h"
+#include "bisho-trace.h"
+#include "bisho-scheduler.h"
 #include "oauth.h"
 
 /* TODO: use sw-keyring */
@@ -39,8 +42,6 @@ static const GnomeKeyringPasswordSchema oauth_schema = {
   }
 };
 
-#define GROUP_OAUTH "OAuth"
-
 struct _BishoPaneOauthPrivate {
   const char *consumer_key;
   const char *consumer_secret;
@@ -50,9 +51,11 @@ struct _BishoPaneOauthPrivate {
   char *access_token_function;
   char *callback;
   RestProxy *proxy;
+  RestProxyCall *call;
   GtkWidget *pin_label;
   GtkWidget *pin_entry;
   GtkWidget *button;
+  int state; /* The ButtonState shown, or -1 */
 };
 
 typedef enum {
@@ -68,6 +71,46 @@ G_DEFINE_DYNAMIC_TYPE (BishoPaneOauth, bisho_pane_oauth, BISHO_TYPE_PANE);
 
 static void update_widgets (BishoPaneOauth *pane, ButtonState state);
 
+/*
+ * Start a token exchange with @function through the scheduler, so that it
+ * times out and is retried like every other call.  This is what
+ * oauth_proxy_request_token_async() and oauth_proxy_access_token_async() do,
+ * but those calls can't be retried or cancelled.
+ */
+static void
+start_token_call (BishoPaneOauth *pane,
+                  const char *function,
+                  const char *param, const char *value,
+                  RestProxyCallAsyncCallback callback)
+{
+  BishoPaneOauthPrivate *priv = pane->priv;
+  RestProxyCall *call;
+
+  call = rest_proxy_new_call (priv->proxy);
+  rest_proxy_call_set_function (call, function);
+  rest_proxy_call_set_method (call, "POST");
+  if (value)
+    rest_proxy_call_add_param (call, param, value);
+
+  priv->call = call;
+  /* The request token and verifier can only be used once */
+  bisho_scheduler_call_async (call, 0, FALSE, callback, G_OBJECT (pane), pane);
+}
+
+/*
+ * Finish the call started with start_token_call(), storing the token in the
+ * proxy if it was successful.
+ */
+static void
+end_token_call (BishoPaneOauth *pane, RestProxyCall *call, const GError *error)
+{
+  if (error == NULL)
+    oauth_proxy_call_parse_token_reponse (OAUTH_PROXY_CALL (call));
+
+  pane->priv->call = NULL;
+  g_object_unref (call);
+}
+
 static char *
 create_url (BishoPaneOauth *pane, const char *token)
 {
@@ -98,16 +141,20 @@ G_GNUC_UNUSED static const char * unused_for_now[] = {
 };
 
 static void
-request_token_cb (OAuthProxy   *proxy,
-                  const GError *error,
-                  GObject      *weak_object,
-                  gpointer      user_data)
+request_token_cb (RestProxyCall *call,
+                  const GError  *error,
+                  GObject       *weak_object,
+                  gpointer       user_data)
 {
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
   BishoPaneOauthPrivate *priv = pane->priv;
   ServiceInfo *info = BISHO_PANE (pane)->info;
   char *url;
 
+  bisho_trace_async_end ("oauth_request_token", pane, info->name);
+
+  end_token_call (pane, call, error);
+
   if (error) {
     update_widgets (pane, LOGGED_OUT);
 
@@ -140,24 +187,20 @@ log_in_clicked (GtkWidget *button, gpointer user_data)
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
   BishoPaneOauthPrivate *priv = pane->priv;
   ServiceInfo *info = BISHO_PANE (pane)->info;
-  GError *error = NULL;
-
-  if (oauth_proxy_request_token_async (OAUTH_PROXY (priv->proxy),
-                                       priv->request_token_function,
-                                       priv->callback,
-                                       request_token_cb,
-                                       NULL,
-                                       pane,
-                                       &error)) {
-    update_widgets (pane, WORKING);
-  } else {
-    update_widgets (pane, LOGGED_OUT);
 
-    g_message ("Error from %s: %s", info->name, error->message);
-    bisho_pane_set_banner_error (BISHO_PANE (pane), error);
-    g_error_free (error);
+  if (priv->call)
     return;
-  }
+
+  /* A request token must not be signed with an old token */
+  oauth_proxy_set_token (OAUTH_PROXY (priv->proxy), NULL);
+  oauth_proxy_set_token_secret (OAUTH_PROXY (priv->proxy), NULL);
+
+  start_token_call (pane,
+                    priv->request_token_function ?: "request_token",
+                    "oauth_callback", priv->callback,
+                    request_token_cb);
+  bisho_trace_async_begin ("oauth_request_token", pane, info->name);
+  update_widgets (pane, WORKING);
 }
 
 
@@ -167,10 +210,13 @@ delete_done_cb (GnomeKeyringResult result, gpointer user_data)
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
   SwClientService *service;
 
+  bisho_trace_async_end ("keyring_delete", pane, BISHO_PANE (pane)->info->name);
+
   if (result == GNOME_KEYRING_RESULT_OK){
     update_widgets (pane, LOGGED_OUT);
     service = sw_client_get_service (BISHO_PANE (pane)->socialweb, BISHO_PANE (pane)->info->name);
     sw_client_service_credentials_updated (service);
+    bisho_utils_reload_accounts ();
   } else {
     update_widgets (pane, LOGGED_IN);
   }
@@ -182,8 +228,12 @@ log_out_clicked (GtkButton *button, gpointer user_data)
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
   BishoPaneOauthPrivate *priv = pane->priv;
 
+  oauth_proxy_set_token (OAUTH_PROXY (priv->proxy), NULL);
+  oauth_proxy_set_token_secret (OAUTH_PROXY (priv->proxy), NULL);
+
   update_widgets (pane, WORKING);
 
+  bisho_trace_async_begin ("keyring_delete", pane, BISHO_PANE (pane)->info->name);
   gnome_keyring_delete_password (&oauth_schema, delete_done_cb, user_data, NULL,
                                  "server", priv->base_url,
                                  "consumer-key", priv->consumer_key,
@@ -191,16 +241,39 @@ log_out_clicked (GtkButton *button, gpointer user_data)
 }
 
 static void
-access_token_cb (OAuthProxy   *proxy,
-                 const GError *error,
-                 GObject      *weak_object,
-                 gpointer      user_data)
+store_done_cb (GnomeKeyringResult result, guint32 item_id, gpointer user_data)
+{
+  BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
+  ServiceInfo *info = BISHO_PANE (pane)->info;
+  SwClientService *service;
+
+  if (result == GNOME_KEYRING_RESULT_OK) {
+    update_widgets (pane, LOGGED_IN);
+    service = sw_client_get_service (BISHO_PANE (pane)->socialweb, info->name);
+    sw_client_service_credentials_updated (service);
+    bisho_utils_reload_accounts ();
+  } else {
+    g_message ("Cannot update keyring: %s", gnome_keyring_result_to_message (result));
+    update_widgets (pane, LOGGED_OUT);
+  }
+
+  g_object_unref (pane);
+}
+
+static void
+access_token_cb (RestProxyCall *call,
+                 const GError  *error,
+                 GObject       *weak_object,
+                 gpointer       user_data)
 {
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
   ServiceInfo *info = BISHO_PANE (pane)->info;
   BishoPaneOauthPrivate *priv = pane->priv;
   char *encoded;
-  SwClientService *service;
+
+  bisho_trace_async_end ("oauth_access_token", pane, info->name);
+
+  end_token_call (pane, call, error);
 
   if (error) {
     update_widgets (pane, LOGGED_OUT);
@@ -213,32 +286,14 @@ access_token_cb (OAuthProxy   *proxy,
     (oauth_proxy_get_token (OAUTH_PROXY (priv->proxy)),
      oauth_proxy_get_token_secret (OAUTH_PROXY (priv->proxy)));
 
-  /* TODO async */
-  GnomeKeyringResult result;
-  GnomeKeyringAttributeList *attrs;
-  guint32 id;
-  attrs = gnome_keyring_attribute_list_new ();
-  gnome_keyring_attribute_list_append_string (attrs, "server", priv->base_url);
-  gnome_keyring_attribute_list_append_string (attrs, "consumer-key", priv->consumer_key);
-
-  result = gnome_keyring_item_create_sync (NULL,
-                                           GNOME_KEYRING_ITEM_GENERIC_SECRET,
-                                           info->display_name,
-                                           attrs, encoded,
-                                           TRUE, &id);
-
-  if (result == GNOME_KEYRING_RESULT_OK) {
-    gnome_keyring_item_grant_access_rights_sync (NULL,
-                                                 "libsocialweb",
-                                                 LIBEXECDIR "/libsocialweb-core",
-                                                 id, GNOME_KEYRING_ACCESS_READ);
-    update_widgets (pane, LOGGED_IN);
-    service = sw_client_get_service (BISHO_PANE (pane)->socialweb, info->name);
-    sw_client_service_credentials_updated (service);
-  } else {
-    g_message ("Cannot update keyring: %s", gnome_keyring_result_to_message (result));
-    update_widgets (pane, LOGGED_OUT);
-  }
+  /* The pane is only updated once the item is both stored and readable */
+  bisho_credentials_store_password (bisho_pane_get_credentials (BISHO_PANE (pane)),
+                                    info->display_name,
+                                    priv->base_url,
+                                    "consumer-key", priv->consumer_key,
+                                    encoded,
+                                    store_done_cb, g_object_ref (pane));
+  g_free (encoded);
 }
 
 static void
@@ -247,7 +302,6 @@ bisho_pane_oauth_continue_auth (BishoPane *_pane, GHashTable *params)
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (_pane);
   BishoPaneOauthPrivate *priv = pane->priv;
   ServiceInfo *info = BISHO_PANE (pane)->info;
-  GError *error = NULL;
   const char *verifier;
 
   /* TODO: check the current state */
@@ -271,20 +325,16 @@ bisho_pane_oauth_continue_auth (BishoPane *_pane, GHashTable *params)
     verifier = NULL;
   }
 
-  if (oauth_proxy_access_token_async (OAUTH_PROXY (priv->proxy),
-                                      priv->access_token_function,
-                                      verifier,
-                                      access_token_cb,
-                                      NULL,
-                                      pane,
-                                      &error)) {
-    update_widgets (pane, WORKING);
-  } else {
-    update_widgets (pane, LOGGED_OUT);
-    g_message ("Error from %s: %s", info->name, error->message);
-    bisho_pane_set_banner_error (BISHO_PANE (pane), error);
+  /* Already exchanging a token */
+  if (priv->call)
     return;
-  }
+
+  start_token_call (pane,
+                    priv->access_token_function ?: "access_token",
+                    "oauth_verifier", verifier,
+                    access_token_cb);
+  bisho_trace_async_begin ("oauth_access_token", pane, info->name);
+  update_widgets (pane, WORKING);
 }
 
 static void
@@ -303,12 +353,18 @@ update_widgets (BishoPaneOauth *pane, ButtonState state)
   priv = pane->priv;
   info = BISHO_PANE (pane)->info;
 
+  /* Confirming the cached state shouldn't disturb the pane */
+  if ((int)state == priv->state)
+    return;
+  priv->state = state;
+
   g_signal_handlers_disconnect_by_func (priv->button, log_out_clicked, pane);
   g_signal_handlers_disconnect_by_func (priv->button, continue_clicked, pane);
   g_signal_handlers_disconnect_by_func (priv->button, log_in_clicked, pane);
 
   switch (state) {
   case LOGGED_OUT:
+    bisho_pane_set_cached_state (BISHO_PANE (pane), FALSE, NULL, NULL);
     bisho_pane_set_banner (BISHO_PANE (pane), NULL);
     gtk_widget_show (priv->button);
     gtk_button_set_label (GTK_BUTTON (priv->button), _("Log me in"));
@@ -351,6 +407,7 @@ update_widgets (BishoPaneOauth *pane, ButtonState state)
     }
     break;
   case LOGGED_IN:
+    bisho_pane_set_cached_state (BISHO_PANE (pane), TRUE, NULL, NULL);
     bisho_pane_set_banner (BISHO_PANE (pane), _("Log in succeeded. You'll see new items in a couple of minutes."));
     gtk_widget_show (priv->button);
     gtk_button_set_label (GTK_BUTTON (priv->button), _("Log me out"));
@@ -360,16 +417,22 @@ update_widgets (BishoPaneOauth *pane, ButtonState state)
 }
 
 static void
-find_key_cb (GnomeKeyringResult result,
-             const char *string,
-             gpointer user_data)
+find_key_cb (GnomeKeyringResult  result,
+             guint32             item_id,
+             const char         *user,
+             const char         *secret,
+             gpointer            user_data)
 {
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (user_data);
 
+  bisho_trace_async_end ("keyring_find", pane, BISHO_PANE (pane)->info->name);
+
   if (result == GNOME_KEYRING_RESULT_OK)
     update_widgets (pane, LOGGED_IN);
   else
     update_widgets (pane, LOGGED_OUT);
+
+  bisho_pane_set_ready (BISHO_PANE (pane));
 }
 
 static const char *
@@ -384,12 +447,13 @@ bisho_pane_oauth_constructed (GObject *object)
   BishoPaneOauth *pane = BISHO_PANE_OAUTH (object);
   BishoPaneOauthPrivate *priv = pane->priv;
   ServiceInfo *info = BISHO_PANE (pane)->info;
+  gboolean logged_in;
 
-  priv->base_url = g_key_file_get_string (info->keys, GROUP_OAUTH, "BaseURL", NULL);
-  priv->request_token_function = g_key_file_get_string (info->keys, GROUP_OAUTH, "RequestTokenFunction", NULL);
-  priv->authorize_function = g_key_file_get_string (info->keys, GROUP_OAUTH, "AuthoriseFunction", NULL);
-  priv->access_token_function = g_key_file_get_string (info->keys, GROUP_OAUTH, "AccessTokenFunction", NULL);
-  priv->callback = g_key_file_get_string (info->keys, GROUP_OAUTH, "Callback", NULL);
+  priv->base_url = g_strdup (info->auth.oauth.base_url);
+  priv->request_token_function = g_strdup (info->auth.oauth.request_token_function);
+  priv->authorize_function = g_strdup (info->auth.oauth.authorize_function);
+  priv->access_token_function = g_strdup (info->auth.oauth.access_token_function);
+  priv->callback = g_strdup (info->auth.oauth.callback);
 
   bisho_pane_follow_connected (BISHO_PANE (pane), priv->button);
 
@@ -397,20 +461,49 @@ bisho_pane_oauth_constructed (GObject *object)
   if (!sw_keystore_get_key_secret (info->name,
                                        &priv->consumer_key,
                                        &priv->consumer_secret)) {
+    bisho_pane_set_ready (BISHO_PANE (pane));
     return;
   }
 
   priv->proxy = oauth_proxy_new (priv->consumer_key,
-                                priv->consumer_secret,
-                                priv->base_url, FALSE);
+                                 priv->consumer_secret,
+                                 priv->base_url, FALSE);
   rest_proxy_set_user_agent (priv->proxy, "Bisho/" VERSION);
 
-  update_widgets (pane, WORKING);
+  /* Show the state from last time straight away, and then check it */
+  if (bisho_pane_get_cached_state (BISHO_PANE (pane), &logged_in, NULL, NULL)) {
+    update_widgets (pane, logged_in ? LOGGED_IN : LOGGED_OUT);
+    bisho_pane_set_banner (BISHO_PANE (pane), NULL);
+  } else {
+    update_widgets (pane, WORKING);
+  }
+
+  bisho_trace_async_begin ("keyring_find", pane, info->name);
+  bisho_credentials_find_password (bisho_pane_get_credentials (BISHO_PANE (pane)),
+                                   priv->base_url,
+                                   "consumer-key", priv->consumer_key,
+                                   find_key_cb, pane);
+}
+
+static void
+bisho_pane_oauth_dispose (GObject *object)
+{
+  BishoPaneOauthPrivate *priv = BISHO_PANE_OAUTH (object)->priv;
+
+  if (priv->call) {
+    RestProxyCall *call = priv->call;
+
+    priv->call = NULL;
+    bisho_scheduler_cancel (call);
+    g_object_unref (call);
+  }
+
+  if (priv->proxy) {
+    g_object_unref (priv->proxy);
+    priv->proxy = NULL;
+  }
 
-  gnome_keyring_find_password (&oauth_schema, find_key_cb, pane, NULL,
-                               "server", priv->base_url,
-                               "consumer-key", priv->consumer_key,
-                               NULL);
+  G_OBJECT_CLASS (bisho_pane_oauth_parent_class)->dispose (object);
 }
 
 static void
@@ -420,6 +513,7 @@ bisho_pane_oauth_class_init (BishoPaneOauthClass *klass)
   BishoPaneClass *pane_class = BISHO_PANE_CLASS (klass);
 
   o_class->constructed = bisho_pane_oauth_constructed;
+  o_class->dispose = bisho_pane_oauth_dispose;
   pane_class->get_auth_type = bisho_pane_oauth_get_auth_type;
   pane_class->continue_auth = bisho_pane_oauth_continue_auth;
 
@@ -439,6 +533,7 @@ bisho_pane_oauth_init (BishoPaneOauth *pane)
 
   pane->priv = GET_PRIVATE (pane);
   priv = pane->priv;
+  priv->state = -1;
 
   content = BISHO_PANE (pane)->content;
 
@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Headless account management, for provisioning and auditing machines without
+ * a display.  Services are read from the installed .keys files and their
+ * credentials from the keyring; no display is opened, although the program
+ * links against the same GTK-based code as bisho.  libsocialweb is only used
+ * to tell its daemon about changed credentials, which needs a session bus.
+ * Output is one line per service with tab-separated fields.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <gnome-keyring.h>
+#include <libsocialweb-client/sw-client.h>
+#include "bisho-cli.h"
+#include "bisho-credentials.h"
+#include "bisho-utils.h"
+#include "service-info.h"
+#include "service-cache.h"
+
+/*
+ * Tell libsocialweb and the accounts daemon that the credentials of the named
+ * services have changed, and give the messages a chance to be sent before
+ * exiting.
+ */
+static void
+notify_services (const char **names, guint n)
+{
+  SwClient *client;
+  GDBusConnection *connection;
+  guint i;
+
+  if (n == 0)
+    return;
+
+  client = sw_client_new ();
+
+  for (i = 0; i < n; i++) {
+    SwClientService *service;
+
+    service = sw_client_get_service (client, names[i]);
+    sw_client_service_credentials_updated (service);
+    g_object_unref (service);
+  }
+
+  bisho_utils_reload_accounts ();
+
+  while (g_main_context_iteration (NULL, FALSE));
+
+  /* We exit next, so make sure the Reload call has been sent */
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+  if (connection) {
+    g_dbus_connection_flush_sync (connection, NULL, NULL);
+    g_object_unref (connection);
+  }
+
+  g_object_unref (client);
+}
+
+static gboolean
+uses_password (ServiceInfo *info)
+{
+  return g_strcmp0 (info->auth_type, "password") == 0 ||
+    g_strcmp0 (info->auth_type, "username") == 0;
+}
+
+/*
+ * --list: name, auth type and display name of every service.
+ */
+int
+bisho_cli_list (void)
+{
+  char **names;
+  int i;
+
+  names = service_cache_list_services ();
+
+  for (i = 0; names[i]; i++) {
+    ServiceInfo *info;
+
+    info = get_info_for_service (names[i]);
+    if (info == NULL)
+      continue;
+
+    g_print ("%s\t%s\t%s\n", names[i],
+             info->auth_type ?: "", info->display_name ?: "");
+
+    service_info_unref (info);
+  }
+
+  g_strfreev (names);
+
+  return 0;
+}
+
+typedef struct {
+  GMainLoop *loop;
+  guint outstanding;
+} StatusRun;
+
+typedef struct {
+  StatusRun *run;
+  const char *state;
+  char *user;
+} Status;
+
+static void
+status_found_cb (GnomeKeyringResult  result,
+                 guint32             item_id,
+                 const char         *user,
+                 const char         *secret,
+                 gpointer            user_data)
+{
+  Status *status = user_data;
+
+  switch (result) {
+  case GNOME_KEYRING_RESULT_OK:
+    status->state = "logged-in";
+    status->user = g_strdup (user);
+    break;
+  case GNOME_KEYRING_RESULT_NO_MATCH:
+    status->state = "logged-out";
+    break;
+  default:
+    g_printerr ("Cannot read keyring: %s\n", gnome_keyring_result_to_message (result));
+    status->state = "error";
+    break;
+  }
+
+  if (--status->run->outstanding == 0)
+    g_main_loop_quit (status->run->loop);
+}
+
+/*
+ * --status: name, state (logged-in, logged-out, unknown or error) and user name
+ * of every service.  All of the keyring lookups are made at once, and the
+ * keyring is queried once for each server they use.
+ */
+int
+bisho_cli_status (void)
+{
+  BishoCredentials *credentials;
+  StatusRun run;
+  Status *statuses;
+  char **names;
+  guint i, n;
+  int ret = 0;
+
+  names = service_cache_list_services ();
+  n = g_strv_length (names);
+  statuses = g_new0 (Status, n);
+
+  run.loop = g_main_loop_new (NULL, FALSE);
+  /* Held until every lookup has been started */
+  run.outstanding = 1;
+
+  credentials = bisho_credentials_new ();
+
+  for (i = 0; i < n; i++) {
+    ServiceInfo *info;
+
+    statuses[i].run = &run;
+    statuses[i].state = "unknown";
+
+    info = get_info_for_service (names[i]);
+    if (info == NULL)
+      continue;
+
+    run.outstanding++;
+    if (!bisho_credentials_find_for_service (credentials, info,
+                                             status_found_cb, &statuses[i]))
+      run.outstanding--;
+
+    service_info_unref (info);
+  }
+
+  if (--run.outstanding > 0)
+    g_main_loop_run (run.loop);
+
+  for (i = 0; i < n; i++) {
+    g_print ("%s\t%s\t%s\n", names[i], statuses[i].state, statuses[i].user ?: "");
+
+    if (strcmp (statuses[i].state, "error") == 0)
+      ret = 1;
+
+    g_free (statuses[i].user);
+  }
+
+  bisho_credentials_unref (credentials);
+  g_main_loop_unref (run.loop);
+  g_free (statuses);
+  g_strfreev (names);
+
+  return ret;
+}
+
+typedef struct {
+  GMainLoop *loop;
+  ServiceInfo *info;
+  char *user;
+  char *password;
+  GnomeKeyringResult result;
+} Login;
+
+static void
+login_replaced_cb (GnomeKeyringResult result, guint32 item_id, gpointer user_data)
+{
+  Login *login = user_data;
+
+  login->result = result;
+  g_main_loop_quit (login->loop);
+}
+
+static void
+login_found_cb (GnomeKeyringResult  result,
+                guint32             item_id,
+                const char         *user,
+                const char         *secret,
+                gpointer            user_data)
+{
+  Login *login = user_data;
+
+  if (result != GNOME_KEYRING_RESULT_OK)
+    item_id = 0;
+
+  bisho_credentials_replace_network_password (NULL, item_id,
+                                              login->info->auth.password.server,
+                                              login->user, login->password,
+                                              login_replaced_cb, login);
+}
+
+/* Read a line from standard input, without the line terminator */
+static char *
+read_line (void)
+{
+  char buffer[1024];
+  size_t len;
+
+  if (fgets (buffer, sizeof (buffer), stdin) == NULL)
+    return NULL;
+
+  len = strlen (buffer);
+  if (len && buffer[len - 1] == '\n')
+    buffer[--len] = '\0';
+  if (len && buffer[len - 1] == '\r')
+    buffer[--len] = '\0';
+
+  return g_strdup (buffer);
+}
+
+/*
+ * --login-password SERVICE: store the user name and password on the first two
+ * lines of standard input as the credentials for SERVICE, replacing any
+ * existing credentials.
+ */
+int
+bisho_cli_login_password (const char *name)
+{
+  Login login = { NULL, };
+
+  login.info = get_info_for_service (name);
+  if (login.info == NULL) {
+    g_printerr ("Unknown service %s\n", name);
+    return 1;
+  }
+
+  if (!uses_password (login.info) || login.info->auth.password.server == NULL) {
+    g_printerr ("%s does not use a user name and password\n", name);
+    service_info_unref (login.info);
+    return 1;
+  }
+
+  login.user = read_line ();
+  if (g_strcmp0 (login.info->auth_type, "password") == 0)
+    login.password = read_line ();
+  else
+    login.password = g_strdup ("");
+
+  if (login.user == NULL || login.password == NULL) {
+    g_printerr ("Expected the user name and password on standard input\n");
+    g_free (login.user);
+    g_free (login.password);
+    service_info_unref (login.info);
+    return 1;
+  }
+
+  login.loop = g_main_loop_new (NULL, FALSE);
+
+  bisho_credentials_find_network_password (NULL, login.info->auth.password.server,
+                                           login_found_cb, &login);
+  g_main_loop_run (login.loop);
+
+  if (login.result == GNOME_KEYRING_RESULT_OK) {
+    g_print ("%s\tlogged-in\t%s\n", name, login.user);
+    notify_services (&name, 1);
+  } else {
+    g_printerr ("Cannot update keyring: %s\n",
+                gnome_keyring_result_to_message (login.result));
+  }
+
+  g_main_loop_unref (login.loop);
+  memset (login.password, 0, strlen (login.password));
+  g_free (login.password);
+  g_free (login.user);
+  service_info_unref (login.info);
+
+  return login.result == GNOME_KEYRING_RESULT_OK ? 0 : 1;
+}
+
+typedef struct {
+  StatusRun *run;
+  const char *name;
+  const char *state;
+} Import;
+
+static void
+import_stored_cb (GnomeKeyringResult result, guint32 item_id, gpointer user_data)
+{
+  Import *import = user_data;
+
+  if (result == GNOME_KEYRING_RESULT_OK) {
+    import->state = "imported";
+  } else {
+    g_printerr ("Cannot store credentials for %s: %s\n",
+                import->name, gnome_keyring_result_to_message (result));
+    import->state = "error";
+  }
+
+  if (--import->run->outstanding == 0)
+    g_main_loop_quit (import->run->loop);
+}
+
+/* Start storing the credentials for @import from @keys, returning FALSE on error */
+static gboolean
+import_service (BishoCredentials *credentials, GKeyFile *keys, Import *import)
+{
+  ServiceInfo *info;
+  char *user = NULL, *secret = NULL;
+  gboolean ret = FALSE;
+
+  info = get_info_for_service (import->name);
+  if (info == NULL) {
+    g_printerr ("Unknown service %s\n", import->name);
+    return FALSE;
+  }
+
+  if (uses_password (info)) {
+    user = g_key_file_get_string (keys, import->name, "user", NULL);
+    secret = g_key_file_get_string (keys, import->name, "password", NULL);
+    if (secret == NULL && g_strcmp0 (info->auth_type, "username") == 0)
+      secret = g_strdup ("");
+  } else if (g_strcmp0 (info->auth_type, "oauth") == 0) {
+    char *token, *token_secret;
+
+    token = g_key_file_get_string (keys, import->name, "token", NULL);
+    token_secret = g_key_file_get_string (keys, import->name, "token-secret", NULL);
+    if (token && token_secret)
+      secret = bisho_utils_encode_tokens (token, token_secret);
+    g_free (token);
+    g_free (token_secret);
+  } else {
+    secret = g_key_file_get_string (keys, import->name, "token", NULL);
+  }
+
+  if (secret == NULL || (uses_password (info) && user == NULL)) {
+    g_printerr ("Incomplete credentials for %s\n", import->name);
+    goto done;
+  }
+
+  import->run->outstanding++;
+  ret = bisho_credentials_store_for_service (credentials, info, user, secret,
+                                             import_stored_cb, import);
+  if (!ret) {
+    import->run->outstanding--;
+    g_printerr ("Cannot store credentials for %s\n", import->name);
+  }
+
+ done:
+  if (secret)
+    memset (secret, 0, strlen (secret));
+  g_free (secret);
+  g_free (user);
+  service_info_unref (info);
+
+  return ret;
+}
+
+/*
+ * --import FILE: store the credentials in FILE, a key file with a group for
+ * each service.  Username and password services use the keys user and
+ * password, OAuth services token and token-secret, and Flickr token.  All of
+ * the keyring writes are started at once, and libsocialweb is told about the
+ * changed services once they have all completed.
+ */
+int
+bisho_cli_import (const char *filename)
+{
+  BishoCredentials *credentials;
+  GKeyFile *keys;
+  GError *error = NULL;
+  StatusRun run;
+  Import *imports;
+  const char **updated;
+  char **groups;
+  gsize i, n, n_updated = 0;
+  int ret = 0;
+
+  keys = g_key_file_new ();
+  if (!g_key_file_load_from_file (keys, filename, G_KEY_FILE_NONE, &error)) {
+    g_printerr ("Cannot read %s: %s\n", filename, error->message);
+    g_error_free (error);
+    g_key_file_free (keys);
+    return 1;
+  }
+
+  groups = g_key_file_get_groups (keys, &n);
+  imports = g_new0 (Import, n);
+
+  run.loop = g_main_loop_new (NULL, FALSE);
+  /* Held until every write has been started */
+  run.outstanding = 1;
+
+  /* Existing username and password items are found in the per-server fetch */
+  credentials = bisho_credentials_new ();
+
+  for (i = 0; i < n; i++) {
+    imports[i].run = &run;
+    imports[i].name = groups[i];
+    imports[i].state = "error";
+
+    import_service (credentials, keys, &imports[i]);
+  }
+
+  if (--run.outstanding > 0)
+    g_main_loop_run (run.loop);
+
+  updated = g_new0 (const char *, n);
+
+  for (i = 0; i < n; i++) {
+    g_print ("%s\t%s\n", imports[i].name, imports[i].state);
+
+    if (strcmp (imports[i].state, "imported") == 0)
+      updated[n_updated++] = imports[i].name;
+    else
+      ret = 1;
+  }
+
+  notify_services (updated, n_updated);
+
+  g_free (updated);
+  bisho_credentials_unref (credentials);
+  g_main_loop_unref (run.loop);
+  g_free (imports);
+  g_strfreev (groups);
+  g_key_file_free (keys);
+
+  return ret;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BISHO_CLI_H__
+#define __BISHO_CLI_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+int bisho_cli_list (void);
+
+int bisho_cli_status (void);
+
+int bisho_cli_login_password (const char *name);
+
+int bisho_cli_import (const char *filename);
+
+G_END_DECLS
+
+#endif /* __BISHO_CLI_H__ */
@@ -0,0 +1,933 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fetches the keyring items of each server that is looked up, once per server,
+ * and indexes them by their attributes, so that services on the same server
+ * share a single keyring round trip.  Only items with one of
+ * those server attributes are ever read.  Lookups made before the fetch for
+ * their server has completed are answered when it does.  If the fetch fails,
+ * lookups fall back to querying the keyring directly.
+ *
+ * Secrets stored with bisho_credentials_store_password() are made readable by
+ * libsocialweb and added to the index.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+#include <gnome-keyring.h>
+#include <libsocialweb-keystore/sw-keystore.h>
+#include "bisho-credentials.h"
+#include "bisho-trace.h"
+
+typedef enum {
+  KIND_GENERIC,
+  KIND_NETWORK,
+  N_KINDS
+} Kind;
+
+typedef struct {
+  guint32 item_id;
+  char *user;
+  char *secret;
+} Entry;
+
+typedef struct {
+  Kind kind;
+  char *server;
+  char *key_attribute;
+  char *key;
+  BishoCredentialsFindFunc func;
+  gpointer user_data;
+} Lookup;
+
+typedef enum {
+  SERVER_UNKNOWN,
+  SERVER_FETCHING,
+  SERVER_READY,
+  SERVER_FAILED
+} ServerState;
+
+typedef struct {
+  BishoCredentials *credentials;
+  Kind kind;
+  char *server;
+} Prefetch;
+
+struct _BishoCredentials {
+  int ref_count;
+  /* Hash of index key to Entry */
+  GHashTable *index[N_KINDS];
+  /* Hash of server to the ServerState of its items */
+  GHashTable *servers[N_KINDS];
+  /* Lookups waiting for a prefetch to complete */
+  GSList *pending;
+};
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->user);
+  gnome_keyring_free_password (entry->secret);
+  g_slice_free (Entry, entry);
+}
+
+static void
+lookup_free (Lookup *lookup)
+{
+  g_free (lookup->server);
+  g_free (lookup->key_attribute);
+  g_free (lookup->key);
+  g_slice_free (Lookup, lookup);
+}
+
+static char *
+make_key (const char *server, const char *key_attribute, const char *key)
+{
+  if (key_attribute)
+    return g_strconcat (server, "\n", key_attribute, "\n", key, NULL);
+  else
+    return g_strdup (server);
+}
+
+static const char *
+get_string_attribute (GnomeKeyringAttributeList *attributes, const char *name)
+{
+  guint i;
+
+  for (i = 0; i < attributes->len; i++) {
+    GnomeKeyringAttribute *attribute;
+
+    attribute = &gnome_keyring_attribute_list_index (attributes, i);
+    if (attribute->type == GNOME_KEYRING_ATTRIBUTE_TYPE_STRING &&
+        g_strcmp0 (attribute->name, name) == 0)
+      return attribute->value.string;
+  }
+
+  return NULL;
+}
+
+static void
+add_entry (GHashTable *index, char *key, GnomeKeyringFound *found, const char *user)
+{
+  Entry *entry;
+
+  /* The first match wins, as with gnome_keyring_find_password() */
+  if (g_hash_table_lookup (index, key)) {
+    g_free (key);
+    return;
+  }
+
+  entry = g_slice_new0 (Entry);
+  entry->item_id = found->item_id;
+  entry->user = g_strdup (user);
+  entry->secret = gnome_keyring_memory_strdup (found->secret);
+
+  g_hash_table_insert (index, key, entry);
+}
+
+static void
+index_found (BishoCredentials *credentials, Kind kind, GnomeKeyringFound *found)
+{
+  GHashTable *index = credentials->index[kind];
+  const char *server;
+  guint i;
+
+  server = get_string_attribute (found->attributes, "server");
+  if (server == NULL)
+    return;
+
+  if (kind == KIND_NETWORK) {
+    add_entry (index, make_key (server, NULL, NULL), found,
+               get_string_attribute (found->attributes, "user"));
+    return;
+  }
+
+  /* Generic secrets are keyed by the server and one other attribute */
+  for (i = 0; i < found->attributes->len; i++) {
+    GnomeKeyringAttribute *attribute;
+
+    attribute = &gnome_keyring_attribute_list_index (found->attributes, i);
+    if (attribute->type != GNOME_KEYRING_ATTRIBUTE_TYPE_STRING ||
+        strcmp (attribute->name, "server") == 0)
+      continue;
+
+    add_entry (index, make_key (server, attribute->name, attribute->value.string),
+               found, NULL);
+  }
+}
+
+typedef struct {
+  BishoCredentialsFindFunc func;
+  gpointer user_data;
+} DirectFind;
+
+static void
+direct_find_free (gpointer data)
+{
+  g_slice_free (DirectFind, data);
+}
+
+static void
+direct_find_items_cb (GnomeKeyringResult result, GList *list, gpointer user_data)
+{
+  DirectFind *find = user_data;
+
+  if (result == GNOME_KEYRING_RESULT_OK && list) {
+    GnomeKeyringFound *found = list->data;
+    find->func (result, found->item_id, NULL, found->secret, find->user_data);
+  } else {
+    if (result == GNOME_KEYRING_RESULT_OK)
+      result = GNOME_KEYRING_RESULT_NO_MATCH;
+    find->func (result, 0, NULL, NULL, find->user_data);
+  }
+}
+
+static void
+direct_find_network_cb (GnomeKeyringResult result, GList *list, gpointer user_data)
+{
+  DirectFind *find = user_data;
+
+  if (result == GNOME_KEYRING_RESULT_OK && list) {
+    GnomeKeyringNetworkPasswordData *data = list->data;
+    find->func (result, data->item_id, data->user, data->password, find->user_data);
+  } else {
+    if (result == GNOME_KEYRING_RESULT_OK)
+      result = GNOME_KEYRING_RESULT_NO_MATCH;
+    find->func (result, 0, NULL, NULL, find->user_data);
+  }
+}
+
+/* Query the keyring for a single item, without the index */
+static void
+direct_find (Kind kind,
+             const char *server,
+             const char *key_attribute,
+             const char *key,
+             BishoCredentialsFindFunc func,
+             gpointer user_data)
+{
+  DirectFind *find;
+
+  find = g_slice_new (DirectFind);
+  find->func = func;
+  find->user_data = user_data;
+
+  if (kind == KIND_NETWORK) {
+    gnome_keyring_find_network_password (NULL, NULL, server, NULL, NULL, NULL, 0,
+                                         direct_find_network_cb, find, direct_find_free);
+  } else {
+    gnome_keyring_find_itemsv (GNOME_KEYRING_ITEM_GENERIC_SECRET,
+                               direct_find_items_cb, find, direct_find_free,
+                               "server", GNOME_KEYRING_ATTRIBUTE_TYPE_STRING, server,
+                               key_attribute, GNOME_KEYRING_ATTRIBUTE_TYPE_STRING, key,
+                               NULL);
+  }
+}
+
+static ServerState
+get_server_state (BishoCredentials *credentials, Kind kind, const char *server)
+{
+  return GPOINTER_TO_INT (g_hash_table_lookup (credentials->servers[kind], server));
+}
+
+static void
+set_server_state (BishoCredentials *credentials, Kind kind, const char *server,
+                  ServerState state)
+{
+  g_hash_table_replace (credentials->servers[kind], g_strdup (server),
+                        GINT_TO_POINTER (state));
+}
+
+static void
+resolve (BishoCredentials *credentials, Lookup *lookup)
+{
+  Entry *entry;
+  char *index_key;
+
+  if (get_server_state (credentials, lookup->kind, lookup->server) == SERVER_FAILED) {
+    direct_find (lookup->kind, lookup->server, lookup->key_attribute, lookup->key,
+                 lookup->func, lookup->user_data);
+    return;
+  }
+
+  index_key = make_key (lookup->server, lookup->key_attribute, lookup->key);
+  entry = g_hash_table_lookup (credentials->index[lookup->kind], index_key);
+  g_free (index_key);
+
+  if (entry) {
+    lookup->func (GNOME_KEYRING_RESULT_OK, entry->item_id,
+                  entry->user, entry->secret, lookup->user_data);
+  } else {
+    lookup->func (GNOME_KEYRING_RESULT_NO_MATCH, 0, NULL, NULL, lookup->user_data);
+  }
+}
+
+static void
+prefetch_cb (GnomeKeyringResult result, GList *list, gpointer user_data)
+{
+  Prefetch *prefetch = user_data;
+  BishoCredentials *credentials = prefetch->credentials;
+  GSList *pending, *l;
+  GList *f;
+
+  bisho_trace_async_end ("keyring_prefetch", prefetch, prefetch->server);
+
+  if (result == GNOME_KEYRING_RESULT_OK || result == GNOME_KEYRING_RESULT_NO_MATCH) {
+    if (result == GNOME_KEYRING_RESULT_OK) {
+      for (f = list; f; f = f->next)
+        index_found (credentials, prefetch->kind, f->data);
+    }
+    set_server_state (credentials, prefetch->kind, prefetch->server, SERVER_READY);
+  } else {
+    g_message ("Cannot prefetch credentials for %s: %s",
+               prefetch->server, gnome_keyring_result_to_message (result));
+    set_server_state (credentials, prefetch->kind, prefetch->server, SERVER_FAILED);
+  }
+
+  /* Answer the lookups which were waiting for this prefetch */
+  pending = credentials->pending;
+  credentials->pending = NULL;
+
+  for (l = pending; l; l = l->next) {
+    Lookup *lookup = l->data;
+
+    if (lookup->kind == prefetch->kind && strcmp (lookup->server, prefetch->server) == 0) {
+      resolve (credentials, lookup);
+      lookup_free (lookup);
+    } else {
+      credentials->pending = g_slist_prepend (credentials->pending, lookup);
+    }
+  }
+
+  credentials->pending = g_slist_reverse (credentials->pending);
+  g_slist_free (pending);
+}
+
+static void
+prefetch_free (gpointer data)
+{
+  Prefetch *prefetch = data;
+
+  bisho_credentials_unref (prefetch->credentials);
+  g_free (prefetch->server);
+  g_slice_free (Prefetch, prefetch);
+}
+
+/* Fetch the items for @server, unless that has already been started */
+static void
+start_prefetch (BishoCredentials *credentials, Kind kind, const char *server)
+{
+  Prefetch *prefetch;
+
+  if (get_server_state (credentials, kind, server) != SERVER_UNKNOWN)
+    return;
+
+  set_server_state (credentials, kind, server, SERVER_FETCHING);
+
+  prefetch = g_slice_new (Prefetch);
+  prefetch->credentials = bisho_credentials_ref (credentials);
+  prefetch->kind = kind;
+  prefetch->server = g_strdup (server);
+
+  bisho_trace_async_begin ("keyring_prefetch", prefetch, server);
+
+  gnome_keyring_find_itemsv (kind == KIND_NETWORK ?
+                             GNOME_KEYRING_ITEM_NETWORK_PASSWORD :
+                             GNOME_KEYRING_ITEM_GENERIC_SECRET,
+                             prefetch_cb, prefetch, prefetch_free,
+                             "server", GNOME_KEYRING_ATTRIBUTE_TYPE_STRING, server,
+                             NULL);
+}
+
+/*
+ * Create a new credentials index.  Items are fetched as services are looked
+ * up.
+ */
+BishoCredentials *
+bisho_credentials_new (void)
+{
+  BishoCredentials *credentials;
+  int i;
+
+  credentials = g_slice_new0 (BishoCredentials);
+  credentials->ref_count = 1;
+
+  for (i = 0; i < N_KINDS; i++) {
+    credentials->index[i] = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify)entry_free);
+    credentials->servers[i] = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                     g_free, NULL);
+  }
+
+  return credentials;
+}
+
+BishoCredentials *
+bisho_credentials_ref (BishoCredentials *credentials)
+{
+  g_return_val_if_fail (credentials, NULL);
+
+  credentials->ref_count++;
+
+  return credentials;
+}
+
+void
+bisho_credentials_unref (BishoCredentials *credentials)
+{
+  int i;
+
+  g_return_if_fail (credentials);
+
+  if (--credentials->ref_count > 0)
+    return;
+
+  /* The prefetches hold a reference, so nothing can be pending */
+  g_assert (credentials->pending == NULL);
+
+  for (i = 0; i < N_KINDS; i++) {
+    g_hash_table_destroy (credentials->index[i]);
+    g_hash_table_destroy (credentials->servers[i]);
+  }
+
+  g_slice_free (BishoCredentials, credentials);
+}
+
+static void
+find (BishoCredentials *credentials,
+      Kind kind,
+      const char *server,
+      const char *key_attribute,
+      const char *key,
+      BishoCredentialsFindFunc func,
+      gpointer user_data)
+{
+  Lookup *lookup;
+
+  if (credentials == NULL || server == NULL) {
+    direct_find (kind, server, key_attribute, key, func, user_data);
+    return;
+  }
+
+  lookup = g_slice_new0 (Lookup);
+  lookup->kind = kind;
+  lookup->server = g_strdup (server);
+  lookup->key_attribute = g_strdup (key_attribute);
+  lookup->key = g_strdup (key);
+  lookup->func = func;
+  lookup->user_data = user_data;
+
+  start_prefetch (credentials, kind, server);
+
+  if (get_server_state (credentials, kind, server) == SERVER_FETCHING) {
+    credentials->pending = g_slist_append (credentials->pending, lookup);
+  } else {
+    resolve (credentials, lookup);
+    lookup_free (lookup);
+  }
+}
+
+/*
+ * Find the generic secret with the attributes server=@server and
+ * @key_attribute=@key.  If @credentials is NULL the keyring is queried
+ * directly.  @func may be called before this function returns.
+ */
+void
+bisho_credentials_find_password (BishoCredentials         *credentials,
+                                 const char               *server,
+                                 const char               *key_attribute,
+                                 const char               *key,
+                                 BishoCredentialsFindFunc  func,
+                                 gpointer                  user_data)
+{
+  g_return_if_fail (server);
+  g_return_if_fail (key_attribute);
+  g_return_if_fail (key);
+  g_return_if_fail (func);
+
+  find (credentials, KIND_GENERIC, server, key_attribute, key, func, user_data);
+}
+
+/*
+ * Find the network password for @server.  If @credentials is NULL the keyring
+ * is queried directly.  @func may be called before this function returns.
+ */
+void
+bisho_credentials_find_network_password (BishoCredentials         *credentials,
+                                         const char               *server,
+                                         BishoCredentialsFindFunc  func,
+                                         gpointer                  user_data)
+{
+  g_return_if_fail (func);
+
+  find (credentials, KIND_NETWORK, server, NULL, NULL, func, user_data);
+}
+
+/*
+ * Find the credentials of the account for @info, wherever its auth type keeps
+ * them.  Returns FALSE, without calling @func, if the auth type is unknown or
+ * the service has no API key.
+ */
+gboolean
+bisho_credentials_find_for_service (BishoCredentials         *credentials,
+                                    ServiceInfo              *info,
+                                    BishoCredentialsFindFunc  func,
+                                    gpointer                  user_data)
+{
+  const char *key, *secret;
+
+  g_return_val_if_fail (info, FALSE);
+  g_return_val_if_fail (func, FALSE);
+
+  if (g_strcmp0 (info->auth_type, "password") == 0 ||
+      g_strcmp0 (info->auth_type, "username") == 0) {
+    if (info->auth.password.server == NULL)
+      return FALSE;
+
+    find (credentials, KIND_NETWORK, info->auth.password.server, NULL, NULL,
+          func, user_data);
+    return TRUE;
+  }
+
+  if (g_strcmp0 (info->auth_type, "oauth") == 0) {
+    if (info->auth.oauth.base_url == NULL ||
+        !sw_keystore_get_key_secret (info->name, &key, &secret))
+      return FALSE;
+
+    find (credentials, KIND_GENERIC, info->auth.oauth.base_url, "consumer-key", key,
+          func, user_data);
+    return TRUE;
+  }
+
+  if (g_strcmp0 (info->auth_type, "flickr") == 0) {
+    if (!sw_keystore_get_key_secret ("flickr", &key, &secret))
+      return FALSE;
+
+    find (credentials, KIND_GENERIC, BISHO_CREDENTIALS_FLICKR_SERVER, "api-key", key,
+          func, user_data);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+typedef struct {
+  BishoCredentials *credentials;
+  char *display_name;
+  char *server;
+  char *key_attribute;
+  char *key;
+  char *secret;
+  guint32 item_id;
+  /* The item that was there before, which the new secret replaces */
+  guint32 old_id;
+  char *old_secret;
+  GnomeKeyringResult result;
+  BishoCredentialsStoreFunc func;
+  gpointer user_data;
+} Store;
+
+static void
+store_finish (Store *store, GnomeKeyringResult result)
+{
+  bisho_trace_async_end ("keyring_store", store, store->server);
+
+  store->func (result, result == GNOME_KEYRING_RESULT_OK ? store->item_id : 0,
+               store->user_data);
+
+  if (store->credentials)
+    bisho_credentials_unref (store->credentials);
+  g_free (store->display_name);
+  g_free (store->server);
+  g_free (store->key_attribute);
+  g_free (store->key);
+  gnome_keyring_free_password (store->secret);
+  gnome_keyring_free_password (store->old_secret);
+  g_slice_free (Store, store);
+}
+
+static void
+store_orphan_deleted_cb (GnomeKeyringResult result, gpointer user_data)
+{
+  Store *store = user_data;
+
+  if (result != GNOME_KEYRING_RESULT_OK)
+    g_message ("Cannot remove keyring item %u: %s",
+               store->item_id, gnome_keyring_result_to_message (result));
+
+  store_finish (store, store->result);
+}
+
+static void
+store_restored_cb (GnomeKeyringResult result, gpointer user_data)
+{
+  Store *store = user_data;
+
+  if (result != GNOME_KEYRING_RESULT_OK)
+    g_message ("Cannot restore keyring item %u: %s",
+               store->item_id, gnome_keyring_result_to_message (result));
+
+  store_finish (store, store->result);
+}
+
+static void
+store_granted_cb (GnomeKeyringResult result, gpointer user_data)
+{
+  Store *store = user_data;
+  BishoCredentials *credentials = store->credentials;
+
+  if (result != GNOME_KEYRING_RESULT_OK) {
+    g_message ("Cannot grant access to keyring item: %s",
+               gnome_keyring_result_to_message (result));
+    store->result = result;
+
+    if (store->old_id && store->item_id == store->old_id) {
+      GnomeKeyringItemInfo *info;
+
+      /* The existing item was updated in place, so put its secret back */
+      info = gnome_keyring_item_info_new ();
+      gnome_keyring_item_info_set_type (info, GNOME_KEYRING_ITEM_GENERIC_SECRET);
+      gnome_keyring_item_info_set_display_name (info, store->display_name);
+      gnome_keyring_item_info_set_secret (info, store->old_secret);
+      gnome_keyring_item_set_info (NULL, store->item_id, info,
+                                   store_restored_cb, store, NULL);
+      gnome_keyring_item_info_free (info);
+    } else {
+      /* libsocialweb can't read the new item, so don't leave it behind */
+      gnome_keyring_item_delete (NULL, store->item_id,
+                                 store_orphan_deleted_cb, store, NULL);
+    }
+    return;
+  }
+
+  if (credentials &&
+      get_server_state (credentials, KIND_GENERIC, store->server) == SERVER_READY) {
+    Entry *entry;
+
+    entry = g_slice_new0 (Entry);
+    entry->item_id = store->item_id;
+    entry->secret = gnome_keyring_memory_strdup (store->secret);
+
+    g_hash_table_replace (credentials->index[KIND_GENERIC],
+                          make_key (store->server, store->key_attribute, store->key),
+                          entry);
+  }
+
+  store_finish (store, GNOME_KEYRING_RESULT_OK);
+}
+
+static void
+store_created_cb (GnomeKeyringResult result, guint32 item_id, gpointer user_data)
+{
+  Store *store = user_data;
+
+  if (result != GNOME_KEYRING_RESULT_OK) {
+    store_finish (store, result);
+    return;
+  }
+
+  store->item_id = item_id;
+  gnome_keyring_item_grant_access_rights (NULL,
+                                          "libsocialweb",
+                                          LIBEXECDIR "/libsocialweb-core",
+                                          item_id, GNOME_KEYRING_ACCESS_READ,
+                                          store_granted_cb, store, NULL);
+}
+
+static void
+store_found_cb (GnomeKeyringResult result, GList *list, gpointer user_data)
+{
+  Store *store = user_data;
+  GnomeKeyringAttributeList *attrs;
+
+  if (result == GNOME_KEYRING_RESULT_OK && list) {
+    GnomeKeyringFound *found = list->data;
+
+    store->old_id = found->item_id;
+    store->old_secret = gnome_keyring_memory_strdup (found->secret);
+  }
+
+  attrs = gnome_keyring_attribute_list_new ();
+  gnome_keyring_attribute_list_append_string (attrs, "server", store->server);
+  gnome_keyring_attribute_list_append_string (attrs, store->key_attribute, store->key);
+
+  gnome_keyring_item_create (NULL, GNOME_KEYRING_ITEM_GENERIC_SECRET,
+                             store->display_name, attrs, store->secret, TRUE,
+                             store_created_cb, store, NULL);
+
+  gnome_keyring_attribute_list_free (attrs);
+}
+
+/*
+ * Store @secret as the generic secret with the attributes server=@server and
+ * @key_attribute=@key, replacing any existing item, and grant libsocialweb
+ * read access to it.  @func is called once both steps have completed.  If
+ * access cannot be granted a new item is deleted again, and an existing item
+ * gets its previous secret back.
+ */
+void
+bisho_credentials_store_password (BishoCredentials          *credentials,
+                                  const char                *display_name,
+                                  const char                *server,
+                                  const char                *key_attribute,
+                                  const char                *key,
+                                  const char                *secret,
+                                  BishoCredentialsStoreFunc  func,
+                                  gpointer                   user_data)
+{
+  Store *store;
+
+  g_return_if_fail (server);
+  g_return_if_fail (key_attribute);
+  g_return_if_fail (key);
+  g_return_if_fail (secret);
+  g_return_if_fail (func);
+
+  store = g_slice_new0 (Store);
+  store->credentials = credentials ? bisho_credentials_ref (credentials) : NULL;
+  store->display_name = g_strdup (display_name);
+  store->server = g_strdup (server);
+  store->key_attribute = g_strdup (key_attribute);
+  store->key = g_strdup (key);
+  store->secret = gnome_keyring_memory_strdup (secret);
+  store->func = func;
+  store->user_data = user_data;
+
+  bisho_trace_async_begin ("keyring_store", store, server);
+
+  /* Find the item this may update, so that it can be restored on failure */
+  gnome_keyring_find_itemsv (GNOME_KEYRING_ITEM_GENERIC_SECRET,
+                             store_found_cb, store, NULL,
+                             "server", GNOME_KEYRING_ATTRIBUTE_TYPE_STRING, server,
+                             key_attribute, GNOME_KEYRING_ATTRIBUTE_TYPE_STRING, key,
+                             NULL);
+}
+
+typedef struct {
+  BishoCredentials *credentials;
+  guint32 old_id;
+  guint32 new_id;
+  char *server;
+  char *user;
+  char *password;
+  BishoCredentialsStoreFunc func;
+  gpointer user_data;
+} Replace;
+
+static void
+replace_finish (Replace *replace, GnomeKeyringResult result)
+{
+  bisho_trace_async_end ("keyring_replace", replace, replace->server);
+
+  replace->func (result, result == GNOME_KEYRING_RESULT_OK ? replace->new_id : 0,
+                 replace->user_data);
+
+  if (replace->credentials)
+    bisho_credentials_unref (replace->credentials);
+  g_free (replace->server);
+  g_free (replace->user);
+  gnome_keyring_free_password (replace->password);
+  g_slice_free (Replace, replace);
+}
+
+static void
+replace_old_deleted_cb (GnomeKeyringResult result, gpointer user_data)
+{
+  Replace *replace = user_data;
+
+  /* The new credentials are in place, so this isn't fatal */
+  if (result != GNOME_KEYRING_RESULT_OK && result != GNOME_KEYRING_RESULT_NO_MATCH)
+    g_message ("Cannot remove keyring item %u: %s",
+               replace->old_id, gnome_keyring_result_to_message (result));
+
+  replace_finish (replace, GNOME_KEYRING_RESULT_OK);
+}
+
+static void
+replace_set_cb (GnomeKeyringResult result, guint32 item_id, gpointer user_data)
+{
+  Replace *replace = user_data;
+  BishoCredentials *credentials = replace->credentials;
+
+  /* On failure the old item is untouched */
+  if (result != GNOME_KEYRING_RESULT_OK) {
+    replace_finish (replace, result);
+    return;
+  }
+
+  replace->new_id = item_id;
+
+  if (credentials &&
+      get_server_state (credentials, KIND_NETWORK, replace->server) == SERVER_READY) {
+    Entry *entry;
+
+    entry = g_slice_new0 (Entry);
+    entry->item_id = item_id;
+    entry->user = g_strdup (replace->user);
+    entry->secret = gnome_keyring_memory_strdup (replace->password);
+
+    g_hash_table_replace (credentials->index[KIND_NETWORK],
+                          make_key (replace->server, NULL, NULL), entry);
+  }
+
+  /* The same user and server updates the existing item in place */
+  if (replace->old_id && replace->old_id != item_id) {
+    gnome_keyring_item_delete (NULL, replace->old_id,
+                               replace_old_deleted_cb, replace, NULL);
+    return;
+  }
+
+  replace_finish (replace, GNOME_KEYRING_RESULT_OK);
+}
+
+/*
+ * Set the network password for @user on @server, and then delete the item
+ * @old_id if it is different.  The old item is only removed once the new
+ * password is stored, so a failure never loses the existing credentials.  @func
+ * is called with the ID of the new item once the replace has completed.
+ */
+void
+bisho_credentials_replace_network_password (BishoCredentials          *credentials,
+                                            guint32                    old_id,
+                                            const char                *server,
+                                            const char                *user,
+                                            const char                *password,
+                                            BishoCredentialsStoreFunc  func,
+                                            gpointer                   user_data)
+{
+  Replace *replace;
+
+  g_return_if_fail (server);
+  g_return_if_fail (user);
+  g_return_if_fail (password);
+  g_return_if_fail (func);
+
+  replace = g_slice_new0 (Replace);
+  replace->credentials = credentials ? bisho_credentials_ref (credentials) : NULL;
+  replace->old_id = old_id;
+  replace->server = g_strdup (server);
+  replace->user = g_strdup (user);
+  replace->password = gnome_keyring_memory_strdup (password);
+  replace->func = func;
+  replace->user_data = user_data;
+
+  bisho_trace_async_begin ("keyring_replace", replace, server);
+
+  gnome_keyring_set_network_password (NULL, user, NULL, server,
+                                      NULL, NULL, NULL, 0, password,
+                                      replace_set_cb, replace, NULL);
+}
+
+typedef struct {
+  BishoCredentials *credentials;
+  char *server;
+  char *user;
+  char *password;
+  BishoCredentialsStoreFunc func;
+  gpointer user_data;
+} ServiceReplace;
+
+static void
+service_replace_found_cb (GnomeKeyringResult  result,
+                          guint32             item_id,
+                          const char         *user,
+                          const char         *secret,
+                          gpointer            user_data)
+{
+  ServiceReplace *replace = user_data;
+
+  bisho_credentials_replace_network_password (replace->credentials,
+                                              result == GNOME_KEYRING_RESULT_OK ? item_id : 0,
+                                              replace->server,
+                                              replace->user, replace->password,
+                                              replace->func, replace->user_data);
+
+  if (replace->credentials)
+    bisho_credentials_unref (replace->credentials);
+  g_free (replace->server);
+  g_free (replace->user);
+  gnome_keyring_free_password (replace->password);
+  g_slice_free (ServiceReplace, replace);
+}
+
+/*
+ * Store @secret as the credentials of the account for @info, wherever its auth
+ * type keeps them.  @user is only used by username and password services,
+ * whose existing credentials are replaced.  Returns FALSE, without calling
+ * @func, if the auth type is unknown or the service has no API key.
+ */
+gboolean
+bisho_credentials_store_for_service (BishoCredentials          *credentials,
+                                     ServiceInfo               *info,
+                                     const char                *user,
+                                     const char                *secret,
+                                     BishoCredentialsStoreFunc  func,
+                                     gpointer                   user_data)
+{
+  const char *key, *key_secret;
+
+  g_return_val_if_fail (info, FALSE);
+  g_return_val_if_fail (secret, FALSE);
+  g_return_val_if_fail (func, FALSE);
+
+  if (g_strcmp0 (info->auth_type, "password") == 0 ||
+      g_strcmp0 (info->auth_type, "username") == 0) {
+    ServiceReplace *replace;
+
+    if (info->auth.password.server == NULL || user == NULL)
+      return FALSE;
+
+    replace = g_slice_new0 (ServiceReplace);
+    replace->credentials = credentials ? bisho_credentials_ref (credentials) : NULL;
+    replace->server = g_strdup (info->auth.password.server);
+    replace->user = g_strdup (user);
+    replace->password = gnome_keyring_memory_strdup (secret);
+    replace->func = func;
+    replace->user_data = user_data;
+
+    find (credentials, KIND_NETWORK, replace->server, NULL, NULL,
+          service_replace_found_cb, replace);
+    return TRUE;
+  }
+
+  if (g_strcmp0 (info->auth_type, "oauth") == 0) {
+    if (info->auth.oauth.base_url == NULL ||
+        !sw_keystore_get_key_secret (info->name, &key, &key_secret))
+      return FALSE;
+
+    bisho_credentials_store_password (credentials, info->display_name,
+                                      info->auth.oauth.base_url,
+                                      "consumer-key", key, secret,
+                                      func, user_data);
+    return TRUE;
+  }
+
+  if (g_strcmp0 (info->auth_type, "flickr") == 0) {
+    if (!sw_keystore_get_key_secret ("flickr", &key, &key_secret))
+      return FALSE;
+
+    bisho_credentials_store_password (credentials, info->display_name,
+                                      BISHO_CREDENTIALS_FLICKR_SERVER,
+                                      "api-key", key, secret,
+                                      func, user_data);
+    return TRUE;
+  }
+
+  return FALSE;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BISHO_CREDENTIALS_H__
+#define __BISHO_CREDENTIALS_H__
+
+#include <glib.h>
+#include <gnome-keyring.h>
+#include "service-info.h"
+
+G_BEGIN_DECLS
+
+/* The server attribute of the Flickr token */
+#define BISHO_CREDENTIALS_FLICKR_SERVER "http://flickr.com/"
+
+typedef struct _BishoCredentials BishoCredentials;
+
+typedef void (*BishoCredentialsFindFunc) (GnomeKeyringResult  result,
+                                          guint32             item_id,
+                                          const char         *user,
+                                          const char         *secret,
+                                          gpointer            user_data);
+
+typedef void (*BishoCredentialsStoreFunc) (GnomeKeyringResult  result,
+                                           guint32             item_id,
+                                           gpointer            user_data);
+
+BishoCredentials * bisho_credentials_new (void);
+
+BishoCredentials * bisho_credentials_ref (BishoCredentials *credentials);
+
+void bisho_credentials_unref (BishoCredentials *credentials);
+
+void bisho_credentials_find_password (BishoCredentials         *credentials,
+                                      const char               *server,
+                                      const char               *key_attribute,
+                                      const char               *key,
+                                      BishoCredentialsFindFunc  func,
+                                      gpointer                  user_data);
+
+void bisho_credentials_find_network_password (BishoCredentials         *credentials,
+                                              const char               *server,
+                                              BishoCredentialsFindFunc  func,
+                                              gpointer                  user_data);
+
+gboolean bisho_credentials_find_for_service (BishoCredentials         *credentials,
+                                             ServiceInfo              *info,
+                                             BishoCredentialsFindFunc  func,
+                                             gpointer                  user_data);
+
+void bisho_credentials_store_password (BishoCredentials          *credentials,
+                                       const char                *display_name,
+                                       const char                *server,
+                                       const char                *key_attribute,
+                                       const char                *key,
+                                       const char                *secret,
+                                       BishoCredentialsStoreFunc  func,
+                                       gpointer                   user_data);
+
+void bisho_credentials_replace_network_password (BishoCredentials          *credentials,
+                                                 guint32                    old_id,
+                                                 const char                *server,
+                                                 const char                *user,
+                                                 const char                *password,
+                                                 BishoCredentialsStoreFunc  func,
+                                                 gpointer                   user_data);
+
+gboolean bisho_credentials_store_for_service (BishoCredentials          *credentials,
+                                              ServiceInfo               *info,
+                                              const char                *user,
+                                              const char                *secret,
+                                              BishoCredentialsStoreFunc  func,
+                                              gpointer                   user_data);
+
+G_END_DECLS
+
+#endif /* __BISHO_CREDENTIALS_H__ */
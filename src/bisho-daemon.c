@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A resident service on the session bus which answers "is this service logged
+ * in?" without each client spawning bisho or reading the keyring itself.
+ *
+ * The service catalog, the keyring index and the libsocialweb capabilities are
+ * loaded once at startup, and every query is answered from memory.  The
+ * keyring index is refreshed in the background when it is older than
+ * REFRESH_INTERVAL, or when a client calls Reload() after changing the
+ * credentials, and StateChanged is emitted for the accounts that changed.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <gnome-keyring.h>
+#include <libsocialweb-client/sw-client.h>
+#include "bisho-daemon.h"
+#include "bisho-credentials.h"
+#include "service-info.h"
+#include "service-cache.h"
+
+/* Microseconds before the keyring index is refreshed */
+#define REFRESH_INTERVAL (30 * G_USEC_PER_SEC)
+
+static const char introspection_xml[] =
+  "<node>"
+  "  <interface name='" BISHO_DAEMON_INTERFACE "'>"
+  "    <method name='ListServices'>"
+  "      <arg type='a(sss)' name='services' direction='out'/>"
+  "    </method>"
+  "    <method name='GetState'>"
+  "      <arg type='s' name='service' direction='in'/>"
+  "      <arg type='s' name='state' direction='out'/>"
+  "      <arg type='s' name='user' direction='out'/>"
+  "    </method>"
+  "    <method name='GetAllStates'>"
+  "      <arg type='a(sss)' name='states' direction='out'/>"
+  "    </method>"
+  "    <method name='GetCapabilities'>"
+  "      <arg type='s' name='service' direction='in'/>"
+  "      <arg type='as' name='caps' direction='out'/>"
+  "    </method>"
+  "    <method name='Reload'/>"
+  "    <signal name='StateChanged'>"
+  "      <arg type='s' name='service'/>"
+  "      <arg type='s' name='state'/>"
+  "      <arg type='s' name='user'/>"
+  "    </signal>"
+  "    <signal name='CapabilitiesChanged'>"
+  "      <arg type='s' name='service'/>"
+  "      <arg type='as' name='caps'/>"
+  "    </signal>"
+  "  </interface>"
+  "</node>";
+
+typedef struct _Daemon Daemon;
+
+typedef struct {
+  Daemon *daemon;
+  ServiceInfo *info;
+  SwClientService *service;
+  /* logged-in, logged-out, unknown or error */
+  const char *state;
+  char *user;
+  char **caps;
+} Account;
+
+struct _Daemon {
+  GMainLoop *loop;
+  GDBusNodeInfo *introspection;
+  GDBusConnection *connection;
+  SwClient *client;
+  /* Sorted array of Account */
+  GPtrArray *accounts;
+  /* Hash of service name to Account */
+  GHashTable *names;
+  BishoCredentials *credentials;
+  /* Set once the keyring has been read for the first time */
+  gboolean ready;
+  /* Calls received before ready */
+  GSList *pending;
+  gboolean refreshing;
+  /* Set when a refresh is asked for while one is running, which may have read
+     the keyring before it changed */
+  gboolean refresh_again;
+  guint outstanding;
+  gint64 refreshed;
+  guint idle_timeout;
+  guint idle_id;
+  int ret;
+};
+
+typedef struct {
+  Daemon *daemon;
+  Account *account;
+} Refresh;
+
+static void answer_call (Daemon *daemon, GDBusMethodInvocation *invocation);
+
+static void
+emit (Daemon *daemon, const char *signal, GVariant *parameters)
+{
+  GError *error = NULL;
+
+  if (daemon->connection == NULL) {
+    g_variant_unref (g_variant_ref_sink (parameters));
+    return;
+  }
+
+  if (!g_dbus_connection_emit_signal (daemon->connection, NULL,
+                                      BISHO_DAEMON_PATH, BISHO_DAEMON_INTERFACE,
+                                      signal, parameters, &error)) {
+    g_message ("Cannot emit %s: %s", signal, error->message);
+    g_error_free (error);
+  }
+}
+
+static void
+account_set_state (Account *account, const char *state, const char *user)
+{
+  Daemon *daemon = account->daemon;
+
+  if (account->state == state && g_strcmp0 (account->user, user) == 0)
+    return;
+
+  account->state = state;
+  g_free (account->user);
+  account->user = g_strdup (user);
+
+  /* The first read of the keyring isn't a change */
+  if (daemon->ready)
+    emit (daemon, "StateChanged",
+          g_variant_new ("(sss)", account->info->name, state, user ?: ""));
+}
+
+static void refresh (Daemon *daemon);
+
+static void
+refresh_done (Daemon *daemon)
+{
+  GSList *pending, *l;
+
+  daemon->refreshing = FALSE;
+  daemon->refreshed = g_get_monotonic_time ();
+
+  if (!daemon->ready) {
+    daemon->ready = TRUE;
+
+    pending = daemon->pending;
+    daemon->pending = NULL;
+    for (l = pending; l; l = l->next)
+      answer_call (daemon, l->data);
+    g_slist_free (pending);
+  }
+
+  if (daemon->refresh_again) {
+    daemon->refresh_again = FALSE;
+    refresh (daemon);
+  }
+}
+
+static void
+refresh_found_cb (GnomeKeyringResult  result,
+                  guint32             item_id,
+                  const char         *user,
+                  const char         *secret,
+                  gpointer            user_data)
+{
+  Refresh *refresh = user_data;
+  Daemon *daemon = refresh->daemon;
+
+  switch (result) {
+  case GNOME_KEYRING_RESULT_OK:
+    account_set_state (refresh->account, "logged-in", user);
+    break;
+  case GNOME_KEYRING_RESULT_NO_MATCH:
+    account_set_state (refresh->account, "logged-out", NULL);
+    break;
+  default:
+    account_set_state (refresh->account, "error", NULL);
+    break;
+  }
+
+  g_slice_free (Refresh, refresh);
+
+  if (--daemon->outstanding == 0)
+    refresh_done (daemon);
+}
+
+/* Read the keyring again, once per server, and update the account states */
+static void
+refresh (Daemon *daemon)
+{
+  guint i;
+
+  if (daemon->refreshing) {
+    daemon->refresh_again = TRUE;
+    return;
+  }
+
+  daemon->refreshing = TRUE;
+
+  if (daemon->credentials)
+    bisho_credentials_unref (daemon->credentials);
+  daemon->credentials = bisho_credentials_new ();
+
+  /* Held until every lookup has been started */
+  daemon->outstanding = 1;
+
+  for (i = 0; i < daemon->accounts->len; i++) {
+    Account *account = g_ptr_array_index (daemon->accounts, i);
+    Refresh *refresh;
+
+    refresh = g_slice_new (Refresh);
+    refresh->daemon = daemon;
+    refresh->account = account;
+
+    daemon->outstanding++;
+    if (!bisho_credentials_find_for_service (daemon->credentials, account->info,
+                                             refresh_found_cb, refresh)) {
+      daemon->outstanding--;
+      g_slice_free (Refresh, refresh);
+      account_set_state (account, "unknown", NULL);
+    }
+  }
+
+  if (--daemon->outstanding == 0)
+    refresh_done (daemon);
+}
+
+static const char *no_caps[] = { NULL };
+
+static void
+set_caps (Account *account, const char **caps)
+{
+  g_strfreev (account->caps);
+  account->caps = g_strdupv ((char **)caps);
+
+  emit (account->daemon, "CapabilitiesChanged",
+        g_variant_new ("(s^as)", account->info->name, caps ?: no_caps));
+}
+
+static void
+caps_changed_cb (SwClientService *service, const char **caps, gpointer user_data)
+{
+  set_caps (user_data, caps);
+}
+
+static void
+got_caps_cb (SwClientService  *service,
+             const char      **caps,
+             const GError     *error,
+             gpointer          user_data)
+{
+  Account *account = user_data;
+
+  if (error) {
+    g_message ("Cannot get capabilities of %s: %s", account->info->name, error->message);
+    return;
+  }
+
+  set_caps (account, caps);
+}
+
+static void
+load_accounts (Daemon *daemon)
+{
+  char **names;
+  int i;
+
+  names = service_cache_list_services ();
+
+  for (i = 0; names[i]; i++) {
+    ServiceInfo *info;
+    Account *account;
+
+    info = get_info_for_service (names[i]);
+    if (info == NULL)
+      continue;
+
+    account = g_slice_new0 (Account);
+    account->daemon = daemon;
+    account->info = info;
+    account->state = "unknown";
+
+    account->service = sw_client_get_service (daemon->client, info->name);
+    g_signal_connect (account->service, "capabilities-changed",
+                      G_CALLBACK (caps_changed_cb), account);
+    sw_client_service_get_dynamic_capabilities (account->service, got_caps_cb, account);
+
+    g_ptr_array_add (daemon->accounts, account);
+    g_hash_table_insert (daemon->names, info->name, account);
+  }
+
+  g_strfreev (names);
+}
+
+static void
+account_free (Account *account)
+{
+  g_signal_handlers_disconnect_by_func (account->service, caps_changed_cb, account);
+  g_object_unref (account->service);
+  service_info_unref (account->info);
+  g_free (account->user);
+  g_strfreev (account->caps);
+  g_slice_free (Account, account);
+}
+
+static gboolean
+idle_timeout_cb (gpointer user_data)
+{
+  Daemon *daemon = user_data;
+
+  daemon->idle_id = 0;
+  g_main_loop_quit (daemon->loop);
+
+  return FALSE;
+}
+
+static void
+reset_idle_timeout (Daemon *daemon)
+{
+  if (daemon->idle_timeout == 0)
+    return;
+
+  if (daemon->idle_id)
+    g_source_remove (daemon->idle_id);
+
+  daemon->idle_id = g_timeout_add_seconds (daemon->idle_timeout, idle_timeout_cb, daemon);
+}
+
+static Account *
+lookup_account (Daemon *daemon, GDBusMethodInvocation *invocation)
+{
+  const char *name;
+  Account *account;
+
+  g_variant_get (g_dbus_method_invocation_get_parameters (invocation), "(&s)", &name);
+
+  account = g_hash_table_lookup (daemon->names, name);
+  if (account == NULL)
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                           "Unknown service %s", name);
+
+  return account;
+}
+
+static void
+answer_call (Daemon *daemon, GDBusMethodInvocation *invocation)
+{
+  const char *method;
+  GVariantBuilder builder;
+  Account *account;
+  guint i;
+
+  method = g_dbus_method_invocation_get_method_name (invocation);
+
+  if (strcmp (method, "ListServices") == 0) {
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sss)"));
+    for (i = 0; i < daemon->accounts->len; i++) {
+      account = g_ptr_array_index (daemon->accounts, i);
+      g_variant_builder_add (&builder, "(sss)", account->info->name,
+                             account->info->auth_type ?: "",
+                             account->info->display_name ?: "");
+    }
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(sss))", &builder));
+  } else if (strcmp (method, "GetState") == 0) {
+    account = lookup_account (daemon, invocation);
+    if (account)
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(ss)", account->state,
+                                                            account->user ?: ""));
+  } else if (strcmp (method, "GetAllStates") == 0) {
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sss)"));
+    for (i = 0; i < daemon->accounts->len; i++) {
+      account = g_ptr_array_index (daemon->accounts, i);
+      g_variant_builder_add (&builder, "(sss)", account->info->name,
+                             account->state, account->user ?: "");
+    }
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(sss))", &builder));
+  } else if (strcmp (method, "GetCapabilities") == 0) {
+    account = lookup_account (daemon, invocation);
+    if (account)
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(^as)",
+                                                            account->caps ?: (char **)no_caps));
+  } else if (strcmp (method, "Reload") == 0) {
+    refresh (daemon);
+    g_dbus_method_invocation_return_value (invocation, NULL);
+  } else {
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method %s", method);
+  }
+}
+
+static void
+method_call_cb (GDBusConnection       *connection,
+                const gchar           *sender,
+                const gchar           *object_path,
+                const gchar           *interface_name,
+                const gchar           *method_name,
+                GVariant              *parameters,
+                GDBusMethodInvocation *invocation,
+                gpointer               user_data)
+{
+  Daemon *daemon = user_data;
+
+  reset_idle_timeout (daemon);
+
+  if (!daemon->ready) {
+    daemon->pending = g_slist_append (daemon->pending, invocation);
+    return;
+  }
+
+  /* Answer from the current index, and bring it up to date for next time */
+  if (!daemon->refreshing &&
+      g_get_monotonic_time () - daemon->refreshed > REFRESH_INTERVAL)
+    refresh (daemon);
+
+  answer_call (daemon, invocation);
+}
+
+static const GDBusInterfaceVTable vtable = {
+  method_call_cb,
+  NULL,
+  NULL
+};
+
+static void
+bus_acquired_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  Daemon *daemon = user_data;
+  GError *error = NULL;
+
+  daemon->connection = g_object_ref (connection);
+
+  if (!g_dbus_connection_register_object (connection, BISHO_DAEMON_PATH,
+                                          daemon->introspection->interfaces[0],
+                                          &vtable, daemon, NULL, &error)) {
+    g_printerr ("Cannot register %s: %s\n", BISHO_DAEMON_PATH, error->message);
+    g_error_free (error);
+    daemon->ret = 1;
+    g_main_loop_quit (daemon->loop);
+  }
+}
+
+static void
+name_lost_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  Daemon *daemon = user_data;
+
+  g_printerr ("Cannot own %s on the session bus\n", name);
+  daemon->ret = 1;
+  g_main_loop_quit (daemon->loop);
+}
+
+/*
+ * Run the account state service until it has been idle for @idle_timeout
+ * seconds, or forever if @idle_timeout is 0.
+ */
+int
+bisho_daemon_run (guint idle_timeout)
+{
+  Daemon daemon = { NULL, };
+  guint owner_id;
+
+  daemon.loop = g_main_loop_new (NULL, FALSE);
+  daemon.introspection = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  g_assert (daemon.introspection);
+  daemon.idle_timeout = idle_timeout;
+
+  daemon.client = sw_client_new ();
+  daemon.accounts = g_ptr_array_new_with_free_func ((GDestroyNotify)account_free);
+  daemon.names = g_hash_table_new (g_str_hash, g_str_equal);
+
+  load_accounts (&daemon);
+  refresh (&daemon);
+
+  owner_id = g_bus_own_name (G_BUS_TYPE_SESSION, BISHO_DAEMON_NAME,
+                             G_BUS_NAME_OWNER_FLAGS_NONE,
+                             bus_acquired_cb, NULL, name_lost_cb,
+                             &daemon, NULL);
+
+  reset_idle_timeout (&daemon);
+
+  g_main_loop_run (daemon.loop);
+
+  g_bus_unown_name (owner_id);
+
+  if (daemon.idle_id)
+    g_source_remove (daemon.idle_id);
+
+  /* Don't leave callers waiting on an index that will never be read */
+  while (daemon.pending) {
+    g_dbus_method_invocation_return_error (daemon.pending->data, G_DBUS_ERROR,
+                                           G_DBUS_ERROR_FAILED, "Exiting");
+    daemon.pending = g_slist_delete_link (daemon.pending, daemon.pending);
+  }
+
+  if (daemon.connection) {
+    g_dbus_connection_flush_sync (daemon.connection, NULL, NULL);
+    g_object_unref (daemon.connection);
+  }
+
+  bisho_credentials_unref (daemon.credentials);
+  g_hash_table_destroy (daemon.names);
+  g_ptr_array_free (daemon.accounts, TRUE);
+  g_object_unref (daemon.client);
+  g_dbus_node_info_unref (daemon.introspection);
+  g_main_loop_unref (daemon.loop);
+
+  return daemon.ret;
+}
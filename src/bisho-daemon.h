@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BISHO_DAEMON_H__
+#define __BISHO_DAEMON_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define BISHO_DAEMON_NAME "com.intel.Bisho.Accounts"
+#define BISHO_DAEMON_PATH "/com/intel/Bisho/Accounts"
+#define BISHO_DAEMON_INTERFACE "com.intel.Bisho.Accounts"
+
+/* Seconds without a call before the daemon exits */
+#define BISHO_DAEMON_DEFAULT_TIMEOUT 60
+
+int bisho_daemon_run (guint idle_timeout);
+
+G_END_DECLS
+
+#endif /* __BISHO_DAEMON_H__ */
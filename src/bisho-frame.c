@@ -25,7 +25,10 @@
 #include "bisho-module.h"
 #include "bisho-frame.h"
 #include "bisho-utils.h"
+#include "bisho-icon-cache.h"
+#include "bisho-trace.h"
 #include "service-info.h"
+#include "service-cache.h"
 #include "bisho-pane-username.h"
 
 struct _BishoFramePrivate {
@@ -33,35 +36,330 @@ struct _BishoFramePrivate {
   GtkWidget *master_box;
   /* Hash of auth type to pane gtypes */
   GHashTable *types;
-  /* Hash of string (identifier) to pane widget */
-  GHashTable *panes;
+  /* Hash of string (identifier) to FrameItem */
+  GHashTable *items;
+  /* Sorted GSequence of the indices of the expanders packed so far */
+  GSequence *indices;
+  /* Number of services being loaded by the thread pool */
+  guint n_loading;
+  /* Number of constructed panes still checking their login state */
+  guint n_unready;
+  /* Keyring items of the constructed panes, fetched once per server */
+  BishoCredentials *credentials;
+  /* Loaded services waiting for their header to be built, in list order */
+  GQueue *ready;
+  guint populate_id;
+  /* The service headers, only one of which is expanded */
+  BishoExpanderGroup *expanders;
+  /* In list mode, the services and the pane of the selected one */
+  GtkListStore *store;
+  GtkWidget *view;
+  GtkWidget *detail;
+  gpointer selected;
 };
 
+/* Microseconds of header construction per main loop iteration */
+#define POPULATE_BUDGET 4000
+
+/*
+ * With this many services the frame shows a list instead of a column of
+ * expanders, as the tree view only lays out and draws the visible rows.  Set
+ * BISHO_LIST_MODE to always use the list.
+ */
+#define LIST_THRESHOLD 50
+#define LIST_WIDTH 240
+#define LIST_ROW_HEIGHT 48
+
+enum {
+  COL_ITEM,
+  COL_ICON,
+  COL_NAME,
+  COL_INDEX,
+  N_COLS
+};
+
+/* A service in the frame.  The pane is only constructed when needed. */
+typedef struct {
+  BishoFrame *frame;
+  ServiceInfo *info;
+  GtkWidget *expander;
+  GtkWidget *pane;
+  guint index;
+  /* The row in list mode, in which case there is no expander */
+  GtkTreeIter iter;
+} FrameItem;
+
+/* A service being loaded by the thread pool */
+typedef struct {
+  BishoFrame *frame;
+  char *name;
+  guint index;
+  ServiceInfo *info;
+} LoadTask;
+
 #define GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), BISHO_TYPE_FRAME, BishoFramePrivate))
 
+enum {
+  READY,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
 G_DEFINE_TYPE (BishoFrame, bisho_frame, GTK_TYPE_VBOX);
 
+static gpointer lookup_pane_type (BishoFrame *frame, const char *auth_type);
+static gpointer load_modules (gpointer foo);
+
 static void
-construct_ui (BishoFrame *frame, const char *service_name)
+frame_item_free (FrameItem *item)
 {
-  ServiceInfo *info;
-  GtkWidget *expander, *pane;
+  service_info_unref (item->info);
+  g_slice_free (FrameItem, item);
+}
+
+/*
+ * Emit "ready" if every service has its header and every constructed pane has
+ * checked its login state.
+ */
+static void
+check_ready (BishoFrame *frame)
+{
+  if (frame->priv->n_loading || frame->priv->n_unready)
+    return;
+
+  bisho_trace_instant ("panes_ready", NULL);
+  g_signal_emit (frame, signals[READY], 0);
+}
+
+static void
+pane_ready_cb (BishoPane *pane, gpointer user_data)
+{
+  BishoFrame *frame = BISHO_FRAME (user_data);
+
+  frame->priv->n_unready--;
+  check_ready (frame);
+}
+
+static GtkWidget *
+ensure_pane (FrameItem *item)
+{
+  BishoFrame *frame = item->frame;
+  ServiceInfo *info = item->info;
+  GtkWidget *pane = NULL;
+  GtkBox *box;
+
+  if (item->pane)
+    return item->pane;
+
+  bisho_trace_begin ("construct_pane", info->name);
+
+  if (g_strcmp0 (info->auth_type, "username") == 0 ||
+      g_strcmp0 (info->auth_type, "password") == 0) {
+    pane = g_object_new (BISHO_TYPE_PANE_USERNAME,
+                         "socialweb", frame->priv->client,
+                         "credentials", frame->priv->credentials,
+                         "service", info,
+                         "with-password", g_str_equal (info->auth_type, "password"),
+                         NULL);
+  } else {
+    gpointer pane_type;
+
+    pane_type = lookup_pane_type (frame, info->auth_type);
+    if (pane_type) {
+      pane = g_object_new (GPOINTER_TO_INT (pane_type),
+                           "socialweb", frame->priv->client,
+                           "credentials", frame->priv->credentials,
+                           "service", info,
+                           NULL);
+    }
+  }
+
+  if (pane == NULL) {
+    bisho_trace_end ("construct_pane", info->name);
+    return NULL;
+  }
+
+  if (item->expander) {
+    box = mux_expanding_item_get_content_box (MUX_EXPANDING_ITEM (item->expander));
+    gtk_widget_show (pane);
+    gtk_box_pack_start (box, pane, FALSE, FALSE, 0);
+  } else {
+    /* Shown when the row is selected */
+    gtk_box_pack_start (GTK_BOX (frame->priv->detail), pane, FALSE, FALSE, 0);
+  }
+
+  item->pane = pane;
+
+  if (!bisho_pane_is_ready (BISHO_PANE (pane))) {
+    frame->priv->n_unready++;
+    g_signal_connect (pane, "ready", G_CALLBACK (pane_ready_cb), frame);
+  }
+
+  bisho_trace_end ("construct_pane", info->name);
+
+  return pane;
+}
+
+static void
+item_expanded_cb (GObject *object, GParamSpec *param_spec, gpointer user_data)
+{
+  FrameItem *item = user_data;
+
+  if (mux_expanding_item_get_active (MUX_EXPANDING_ITEM (object)))
+    ensure_pane (item);
+}
+
+static void
+selection_changed_cb (GtkTreeSelection *selection, gpointer user_data)
+{
+  BishoFrame *frame = BISHO_FRAME (user_data);
+  BishoFramePrivate *priv = frame->priv;
+  FrameItem *item = NULL, *previous;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+
+  if (gtk_tree_selection_get_selected (selection, &model, &iter))
+    gtk_tree_model_get (model, &iter, COL_ITEM, &item, -1);
+
+  previous = priv->selected;
+  if (item == previous)
+    return;
+
+  if (previous && previous->pane)
+    gtk_widget_hide (previous->pane);
+
+  priv->selected = item;
+
+  /* The pane is constructed when the row is first selected */
+  if (item && ensure_pane (item))
+    gtk_widget_show (item->pane);
+}
+
+/* Switch the frame to showing the services as a list */
+static void
+construct_list (BishoFrame *frame)
+{
+  BishoFramePrivate *priv = frame->priv;
+  GtkWidget *box, *scrolled;
+  GtkTreeViewColumn *column;
+  GtkCellRenderer *renderer;
+  GtkTreeSelection *selection;
+
+  priv->store = gtk_list_store_new (N_COLS, G_TYPE_POINTER, GDK_TYPE_PIXBUF,
+                                    G_TYPE_STRING, G_TYPE_UINT);
+  /* Services arrive in any order, so keep the rows in list order */
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (priv->store),
+                                        COL_INDEX, GTK_SORT_ASCENDING);
+
+  priv->view = gtk_tree_view_new_with_model (GTK_TREE_MODEL (priv->store));
+  g_object_unref (priv->store);
+  gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (priv->view), FALSE);
+  gtk_tree_view_set_search_column (GTK_TREE_VIEW (priv->view), COL_NAME);
+
+  column = gtk_tree_view_column_new ();
+  gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_FIXED);
+  gtk_tree_view_column_set_fixed_width (column, LIST_WIDTH);
+
+  renderer = gtk_cell_renderer_pixbuf_new ();
+  gtk_cell_renderer_set_fixed_size (renderer, -1, LIST_ROW_HEIGHT);
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_add_attribute (column, renderer, "pixbuf", COL_ICON);
+
+  renderer = gtk_cell_renderer_text_new ();
+  g_object_set (renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+  gtk_tree_view_column_pack_start (column, renderer, TRUE);
+  gtk_tree_view_column_add_attribute (column, renderer, "text", COL_NAME);
+
+  gtk_tree_view_append_column (GTK_TREE_VIEW (priv->view), column);
+
+  /* Every row is the same height, so rows off screen are never measured */
+  gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (priv->view), TRUE);
+
+  selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (priv->view));
+  gtk_tree_selection_set_mode (selection, GTK_SELECTION_SINGLE);
+  g_signal_connect (selection, "changed", G_CALLBACK (selection_changed_cb), frame);
+
+  scrolled = gtk_scrolled_window_new (NULL, NULL);
+  gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
+                                  GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (scrolled), GTK_SHADOW_IN);
+  gtk_container_add (GTK_CONTAINER (scrolled), priv->view);
+
+  priv->detail = gtk_vbox_new (FALSE, 8);
+  gtk_container_set_border_width (GTK_CONTAINER (priv->detail), 8);
+
+  box = gtk_hbox_new (FALSE, 8);
+  gtk_box_pack_start (GTK_BOX (box), scrolled, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (box), priv->detail, TRUE, TRUE, 0);
+  gtk_widget_show_all (box);
+  gtk_box_pack_start (GTK_BOX (frame), box, TRUE, TRUE, 0);
+}
+
+static void
+construct_row (BishoFrame *frame, ServiceInfo *info, guint index)
+{
+  FrameItem *item;
+  GdkPixbuf *icon = NULL;
+
+  item = g_slice_new0 (FrameItem);
+  item->frame = frame;
+  item->info = service_info_ref (info);
+  item->index = index;
+  g_hash_table_insert (frame->priv->items, info->name, item);
+
+  if (info->icon)
+    icon = bisho_icon_cache_lookup (info->icon);
+
+  /* List store iters persist, so the item can keep its row */
+  gtk_list_store_insert_with_values (frame->priv->store, &item->iter, -1,
+                                     COL_ITEM, item,
+                                     COL_ICON, icon,
+                                     COL_NAME, info->display_name,
+                                     COL_INDEX, index,
+                                     -1);
+
+  if (icon)
+    g_object_unref (icon);
+}
+
+static int
+compare_indices (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  return (int)GPOINTER_TO_UINT (a) - (int)GPOINTER_TO_UINT (b);
+}
+
+static void
+construct_ui (BishoFrame *frame, ServiceInfo *info, guint index)
+{
+  GtkWidget *expander;
   GtkBox *box;
   MuxExpandingItem *m;
+  FrameItem *item;
+  GdkPixbuf *icon = NULL;
+  GSequenceIter *iter;
+  int position;
 
   g_assert (frame);
-  g_assert (service_name);
+  g_assert (info);
 
-  info = get_info_for_service (service_name);
-  if (info == NULL)
+  if (g_hash_table_lookup (frame->priv->items, info->name))
     return;
 
+  if (frame->priv->store) {
+    construct_row (frame, info, index);
+    return;
+  }
+
   expander = mux_expanding_item_new ();
   m = MUX_EXPANDING_ITEM (expander);
 
-  bisho_utils_make_exclusive_expander (m);
-  if (info->icon) {
-    mux_expanding_item_set_icon_from_file (m, info->icon);
+  bisho_expander_group_add (frame->priv->expanders, m);
+  if (info->icon)
+    icon = bisho_icon_cache_lookup (info->icon);
+  if (icon) {
+    mux_expanding_item_set_icon_from_pixbuf (m, icon);
+    g_object_unref (icon);
   } else {
     mux_expanding_item_set_label (m, info->display_name);
   }
@@ -70,31 +368,167 @@ construct_ui (BishoFrame *frame, const char *service_name)
   gtk_container_set_border_width (GTK_CONTAINER (box), 8);
   gtk_box_set_spacing (box, 8);
 
-  if (g_strcmp0 (info->auth_type, "username") == 0) {
-    pane = bisho_pane_username_new (info, FALSE);
-    gtk_widget_show (pane);
-    gtk_box_pack_start (GTK_BOX (box), pane, FALSE, FALSE, 0);
-  } else if (g_strcmp0 (info->auth_type, "password") == 0) {
-    pane = bisho_pane_username_new (info, TRUE);
-    gtk_widget_show (pane);
-    gtk_box_pack_start (GTK_BOX (box), pane, FALSE, FALSE, 0);
-  } else {
-    gpointer pane_type;
+  /* Services arrive in any order, so place it after the ones before it and
+     the introduction label */
+  iter = g_sequence_insert_sorted (frame->priv->indices, GUINT_TO_POINTER (index),
+                                   compare_indices, NULL);
+  position = g_sequence_iter_get_position (iter) + 1;
 
-    pane_type = g_hash_table_lookup (frame->priv->types, info->auth_type);
-    if (pane_type) {
-      pane = g_object_new (GPOINTER_TO_INT (pane_type),
-                           "socialweb", frame->priv->client,
-                           "service", info,
-                           NULL);
-      gtk_widget_show (pane);
-      gtk_box_pack_start (GTK_BOX (box), pane, FALSE, FALSE, 0);
-      g_hash_table_insert (frame->priv->panes, info->name, pane);
-    }
-  }
+  /* The pane is constructed when the item is first expanded */
+  item = g_slice_new0 (FrameItem);
+  item->frame = frame;
+  item->info = service_info_ref (info);
+  item->expander = expander;
+  item->index = index;
+  g_hash_table_insert (frame->priv->items, info->name, item);
+
+  g_signal_connect (expander, "notify::expanded", G_CALLBACK (item_expanded_cb), item);
 
   gtk_widget_show_all (expander);
   gtk_box_pack_start (GTK_BOX (frame), expander, FALSE, FALSE, 0);
+  gtk_box_reorder_child (GTK_BOX (frame), expander, position);
+}
+
+static void
+load_task_free (LoadTask *task)
+{
+  g_object_unref (task->frame);
+  g_free (task->name);
+  service_info_unref (task->info);
+  g_slice_free (LoadTask, task);
+}
+
+static int
+compare_tasks (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const LoadTask *task_a = a, *task_b = b;
+
+  return (int)task_a->index - (int)task_b->index;
+}
+
+/*
+ * Build the headers for the loaded services, top of the list first, until the
+ * time budget for this iteration is used up.  This runs at idle priority, so
+ * input and redraws are handled between each chunk.
+ */
+static gboolean
+populate_idle (gpointer data)
+{
+  BishoFrame *frame = BISHO_FRAME (data);
+  BishoFramePrivate *priv = frame->priv;
+  LoadTask *task;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+
+  bisho_trace_begin ("populate_chunk", NULL);
+
+  while ((task = g_queue_pop_head (priv->ready))) {
+    if (task->info) {
+      bisho_trace_begin ("construct_ui", task->name);
+      construct_ui (frame, task->info, task->index);
+      bisho_trace_end ("construct_ui", task->name);
+    }
+
+    /* Every icon has now been decoded, so keep them for next time */
+    if (--priv->n_loading == 0) {
+      bisho_trace_instant ("headers_ready", NULL);
+      bisho_icon_cache_save ();
+      check_ready (frame);
+    }
+
+    load_task_free (task);
+
+    if (g_get_monotonic_time () - start >= POPULATE_BUDGET)
+      break;
+  }
+
+  bisho_trace_end ("populate_chunk", NULL);
+
+  if (g_queue_is_empty (priv->ready)) {
+    priv->populate_id = 0;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+load_service_done (gpointer data)
+{
+  LoadTask *task = data;
+  BishoFramePrivate *priv = task->frame->priv;
+
+  /* The client is cleared when the frame is destroyed */
+  if (priv->client == NULL) {
+    load_task_free (task);
+    return FALSE;
+  }
+
+  g_queue_insert_sorted (priv->ready, task, compare_tasks, NULL);
+
+  if (priv->populate_id == 0)
+    priv->populate_id = g_idle_add (populate_idle, task->frame);
+
+  return FALSE;
+}
+
+/* Runs in a worker thread, so must not touch the frame */
+static void
+load_service_func (gpointer data, gpointer user_data)
+{
+  static GOnce once = G_ONCE_INIT;
+  LoadTask *task = data;
+
+  g_once (&once, load_modules, NULL);
+
+  bisho_trace_begin ("load_service", task->name);
+
+  task->info = get_info_for_service (task->name);
+
+  /* Register the pane type and decode the icon here instead of in the main
+     loop */
+  if (task->info) {
+    bisho_module_load_for_auth_type (task->info->auth_type);
+
+    if (task->info->icon) {
+      GdkPixbuf *icon;
+
+      icon = bisho_icon_cache_lookup (task->info->icon);
+      if (icon)
+        g_object_unref (icon);
+    }
+  }
+
+  bisho_trace_end ("load_service", task->name);
+
+  g_idle_add (load_service_done, task);
+}
+
+static void
+load_service (BishoFrame *frame, const char *service_name, guint index)
+{
+  static GThreadPool *pool = NULL;
+  LoadTask *task;
+
+  task = g_slice_new0 (LoadTask);
+  task->frame = g_object_ref (frame);
+  task->name = g_strdup (service_name);
+  task->index = index;
+
+  frame->priv->n_loading++;
+
+  if (!g_thread_supported ()) {
+    load_service_func (task, NULL);
+    return;
+  }
+
+  if (pool == NULL) {
+    /* Descriptor parsing is mostly I/O, so a few threads are plenty */
+    pool = g_thread_pool_new (load_service_func, NULL, 4, FALSE, NULL);
+  }
+
+  g_thread_pool_push (pool, task, NULL);
 }
 
 static void
@@ -103,10 +537,22 @@ client_get_services_cb (SwClient *client,
                         gpointer      userdata)
 {
   BishoFrame *frame = BISHO_FRAME (userdata);
+  BishoFramePrivate *priv = frame->priv;
   const GList *l;
+  guint index = 0;
+
+  bisho_trace_async_end ("sw_client_get_services", frame, NULL);
 
-  for (l = services; l; l = l->next) {
-    construct_ui (frame, l->data);
+  /* The mode can only be picked before anything has been shown */
+  if (priv->store == NULL &&
+      g_hash_table_size (priv->items) == 0 && priv->n_loading == 0 &&
+      (g_list_length ((GList *)services) >= LIST_THRESHOLD ||
+       g_getenv ("BISHO_LIST_MODE"))) {
+    construct_list (frame);
+  }
+
+  for (l = services; l; l = l->next, index++) {
+    load_service (frame, l->data, index);
   }
 }
 
@@ -116,6 +562,8 @@ find_panes (BishoFrame *frame)
   GType *types;
   guint i, count = 0;
 
+  bisho_trace_begin ("find_panes", NULL);
+
   /* Explicitly register the internal panes */
   g_type_class_peek (BISHO_TYPE_PANE_USERNAME);
 
@@ -138,54 +586,55 @@ find_panes (BishoFrame *frame)
   }
 
   g_free (types);
+
+  bisho_trace_end ("find_panes", NULL);
 }
 
 static gpointer
 load_modules (gpointer foo)
 {
-  GError *error = NULL;
-  const char *name;
-  GDir *dir;
-
-  dir = g_dir_open (PKGLIBDIR, 0, &error);
-
-  if (!dir) {
-    if (error->domain != G_FILE_ERROR || error->code != G_FILE_ERROR_NOENT)
-      g_printerr ("Cannot open module directory: %s\n", error->message);
-    g_error_free (error);
-    return NULL;
-  }
-
-  while ((name = g_dir_read_name (dir))) {
-    if (g_str_has_suffix (name, ".so")) {
-      BishoModule *module;
-      char *path;
-
-      path = g_build_filename (PKGLIBDIR, name, NULL);
-      module = bisho_module_new (path);
-
-      if (!g_type_module_use (G_TYPE_MODULE (module))) {
-        g_printerr ("Cannot load module %s\n", path);
-        g_object_unref (module);
-        g_free (path);
-        continue;
-      }
+  bisho_trace_begin ("load_modules", NULL);
+  bisho_module_scan (PKGLIBDIR);
+  bisho_trace_end ("load_modules", NULL);
 
-      g_free (path);
+  return NULL;
+}
 
-      g_type_module_unuse (G_TYPE_MODULE (module));
-    }
+static gpointer
+lookup_pane_type (BishoFrame *frame, const char *auth_type)
+{
+  gpointer pane_type;
+
+  pane_type = g_hash_table_lookup (frame->priv->types, auth_type);
+
+  /*
+   * Load the module on demand, and find the types it registered.  Modules
+   * without a manifest were loaded by the scan in the worker thread, after
+   * the frame last looked for panes, so look again for those too.
+   */
+  if (pane_type == NULL) {
+    bisho_module_load_for_auth_type (auth_type);
+    find_panes (frame);
+    pane_type = g_hash_table_lookup (frame->priv->types, auth_type);
   }
 
-  g_dir_close (dir);
-
-  return NULL;
+  return pane_type;
 }
 
 static void
 bisho_frame_dispose (GObject *object)
 {
   BishoFramePrivate *priv = BISHO_FRAME (object)->priv;
+  LoadTask *task;
+
+  if (priv->populate_id)
+    {
+      g_source_remove (priv->populate_id);
+      priv->populate_id = 0;
+    }
+
+  while ((task = g_queue_pop_head (priv->ready)))
+    load_task_free (task);
 
   if (priv->client)
     {
@@ -193,18 +642,45 @@ bisho_frame_dispose (GObject *object)
       priv->client = NULL;
     }
 
+  if (priv->credentials)
+    {
+      bisho_credentials_unref (priv->credentials);
+      priv->credentials = NULL;
+    }
+
   G_OBJECT_CLASS (bisho_frame_parent_class)->dispose (object);
 }
 
+static void
+bisho_frame_finalize (GObject *object)
+{
+  BishoFramePrivate *priv = BISHO_FRAME (object)->priv;
+
+  g_hash_table_destroy (priv->items);
+  g_hash_table_destroy (priv->types);
+  g_queue_free (priv->ready);
+  g_sequence_free (priv->indices);
+  bisho_expander_group_free (priv->expanders);
+
+  G_OBJECT_CLASS (bisho_frame_parent_class)->finalize (object);
+}
+
 static void
 bisho_frame_class_init (BishoFrameClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
-  static GOnce once = G_ONCE_INIT;
-
-  g_once (&once, load_modules, NULL);
 
   object_class->dispose = bisho_frame_dispose;
+  object_class->finalize = bisho_frame_finalize;
+
+  /* Panes are only constructed when shown, so this is first emitted once
+     every header has been built */
+  signals[READY] = g_signal_new ("ready",
+                                 G_TYPE_FROM_CLASS (klass),
+                                 G_SIGNAL_RUN_LAST,
+                                 0, NULL, NULL,
+                                 g_cclosure_marshal_VOID__VOID,
+                                 G_TYPE_NONE, 0);
 
   g_type_class_add_private (klass, sizeof (BishoFramePrivate));
 }
@@ -228,9 +704,14 @@ bisho_frame_init (BishoFrame *self)
   gtk_widget_show (label);
   gtk_box_pack_start (GTK_BOX (self), label, FALSE, FALSE, 0);
 
-  self->priv->panes = g_hash_table_new (g_str_hash, g_str_equal);
+  self->priv->items = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             NULL, (GDestroyNotify)frame_item_free);
 
   self->priv->types = g_hash_table_new (g_str_hash, g_str_equal);
+
+  self->priv->ready = g_queue_new ();
+  self->priv->indices = g_sequence_new (NULL);
+  self->priv->expanders = bisho_expander_group_new ();
   find_panes (self);
 
   self->priv->client = sw_client_new ();
@@ -247,17 +728,44 @@ bisho_frame_populate (BishoFrame *frame)
 {
   g_return_if_fail (BISHO_IS_FRAME (frame));
 
+  /* Shared by the panes, so that services on one server query it once */
+  if (frame->priv->credentials == NULL)
+    frame->priv->credentials = bisho_credentials_new ();
+
+  /* Check the service catalog once for this batch of lookups */
+  service_cache_invalidate ();
+
+  bisho_trace_async_begin ("sw_client_get_services", frame, NULL);
   sw_client_get_services (frame->priv->client, client_get_services_cb, frame);
 }
 
 void
 bisho_frame_callback (BishoFrame *frame, const char *id, GHashTable *params)
 {
-  BishoPane *pane;
+  FrameItem *item;
+  GtkWidget *pane;
 
-  pane = g_hash_table_lookup (frame->priv->panes, id);
+  g_return_if_fail (BISHO_IS_FRAME (frame));
+
+  item = g_hash_table_lookup (frame->priv->items, id);
+  if (item == NULL)
+    return;
+
+  /* Show the pane, constructing it if it has never been expanded */
+  if (item->expander) {
+    mux_expanding_item_set_active (MUX_EXPANDING_ITEM (item->expander), TRUE);
+  } else {
+    GtkTreePath *path;
+
+    gtk_tree_selection_select_iter
+      (gtk_tree_view_get_selection (GTK_TREE_VIEW (frame->priv->view)), &item->iter);
+    path = gtk_tree_model_get_path (GTK_TREE_MODEL (frame->priv->store), &item->iter);
+    gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (frame->priv->view), path, NULL, FALSE, 0, 0);
+    gtk_tree_path_free (path);
+  }
+  pane = ensure_pane (item);
   if (pane)
-    bisho_pane_continue_auth (pane, params);
+    bisho_pane_continue_auth (BISHO_PANE (pane), params);
 }
 
 SwClient *
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A process-wide cache of service icons, decoded and scaled to fit a service
+ * header.  The decoded icons can be saved as a single uncompressed blob, which
+ * is mapped on the next start so that icons don't need decoding at all.
+ *
+ * The blob is an IconHeader, the IconEntry table, and then the filenames and
+ * pixel data, which entries reference by offset.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "bisho-icon-cache.h"
+
+#define ICON_MAGIC "BISHOICO"
+#define ICON_VERSION 1
+
+typedef struct {
+  char magic[8];
+  guint32 version;
+  guint32 n_entries;
+} IconHeader;
+
+typedef struct {
+  gint64 mtime;
+  guint32 filename;
+  guint32 width;
+  guint32 height;
+  guint32 rowstride;
+  guint32 has_alpha;
+  guint32 pixels;
+} IconEntry;
+
+G_LOCK_DEFINE_STATIC (icons);
+/* Hash of filename to GdkPixbuf */
+static GHashTable *icons = NULL;
+/* Icons decoded since the blob was written */
+static gboolean dirty = FALSE;
+/* The blob is kept mapped as pixbufs reference it */
+static GMappedFile *blob = NULL;
+static gboolean blob_opened = FALSE;
+
+static char *
+get_blob_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "bisho", "icons.cache", NULL);
+}
+
+static gint64
+get_mtime (const char *path)
+{
+  struct stat st;
+
+  if (g_stat (path, &st) != 0)
+    return -1;
+
+  return st.st_mtime;
+}
+
+/* Must be called with the lock held */
+static void
+ensure_blob (void)
+{
+  const IconHeader *header;
+  char *filename;
+  gsize length;
+
+  if (blob_opened)
+    return;
+
+  blob_opened = TRUE;
+
+  filename = get_blob_filename ();
+  blob = g_mapped_file_new (filename, FALSE, NULL);
+  g_free (filename);
+
+  if (blob == NULL)
+    return;
+
+  header = (const IconHeader *)g_mapped_file_get_contents (blob);
+  length = g_mapped_file_get_length (blob);
+
+  if (length < sizeof (IconHeader) ||
+      memcmp (header->magic, ICON_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != ICON_VERSION ||
+      sizeof (IconHeader) + (gsize)header->n_entries * sizeof (IconEntry) > length) {
+    g_mapped_file_unref (blob);
+    blob = NULL;
+  }
+}
+
+/* Must be called with the lock held */
+static GdkPixbuf *
+load_from_blob (const char *filename)
+{
+  const char *data;
+  const IconHeader *header;
+  const IconEntry *entries;
+  gsize length;
+  guint i;
+
+  ensure_blob ();
+
+  if (blob == NULL)
+    return NULL;
+
+  data = g_mapped_file_get_contents (blob);
+  length = g_mapped_file_get_length (blob);
+  header = (const IconHeader *)data;
+  entries = (const IconEntry *)(data + sizeof (IconHeader));
+
+  for (i = 0; i < header->n_entries; i++) {
+    const IconEntry *entry = &entries[i];
+    int n_channels;
+
+    if (entry->filename >= length ||
+        memchr (data + entry->filename, '\0', length - entry->filename) == NULL ||
+        strcmp (data + entry->filename, filename) != 0)
+      continue;
+
+    if (entry->mtime != get_mtime (filename))
+      return NULL;
+
+    n_channels = entry->has_alpha ? 4 : 3;
+    if (entry->width == 0 || entry->height == 0 ||
+        entry->pixels + (gsize)entry->rowstride * (entry->height - 1)
+        + (gsize)entry->width * n_channels > length)
+      return NULL;
+
+    /* The pixbuf is never modified, so it can point into the mapping */
+    return gdk_pixbuf_new_from_data ((const guchar *)data + entry->pixels,
+                                     GDK_COLORSPACE_RGB, entry->has_alpha, 8,
+                                     entry->width, entry->height,
+                                     entry->rowstride,
+                                     NULL, NULL);
+  }
+
+  return NULL;
+}
+
+static GdkPixbuf *
+load_from_file (const char *filename)
+{
+  GdkPixbuf *pixbuf, *scaled;
+  GError *error = NULL;
+  int width, height;
+
+  pixbuf = gdk_pixbuf_new_from_file (filename, &error);
+  if (pixbuf == NULL) {
+    g_message ("Cannot load icon %s: %s", filename, error->message);
+    g_error_free (error);
+    return NULL;
+  }
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  if (width <= BISHO_ICON_CACHE_SIZE && height <= BISHO_ICON_CACHE_SIZE)
+    return pixbuf;
+
+  if (width > height) {
+    height = MAX (1, height * BISHO_ICON_CACHE_SIZE / width);
+    width = BISHO_ICON_CACHE_SIZE;
+  } else {
+    width = MAX (1, width * BISHO_ICON_CACHE_SIZE / height);
+    height = BISHO_ICON_CACHE_SIZE;
+  }
+
+  scaled = gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_BILINEAR);
+  g_object_unref (pixbuf);
+
+  return scaled;
+}
+
+/*
+ * Get the icon in @filename, scaled to fit a service header.  Returns a new
+ * reference, or NULL if the icon cannot be loaded.  This can be called from
+ * any thread.
+ */
+GdkPixbuf *
+bisho_icon_cache_lookup (const char *filename)
+{
+  GdkPixbuf *pixbuf, *existing;
+
+  g_return_val_if_fail (filename, NULL);
+
+  G_LOCK (icons);
+
+  if (icons == NULL)
+    icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+  pixbuf = g_hash_table_lookup (icons, filename);
+
+  if (pixbuf == NULL) {
+    pixbuf = load_from_blob (filename);
+    if (pixbuf)
+      g_hash_table_insert (icons, g_strdup (filename), pixbuf);
+  }
+
+  if (pixbuf) {
+    g_object_ref (pixbuf);
+    G_UNLOCK (icons);
+    return pixbuf;
+  }
+
+  G_UNLOCK (icons);
+
+  /* Don't hold the lock while decoding, so icons can be decoded in parallel */
+  pixbuf = load_from_file (filename);
+  if (pixbuf == NULL)
+    return NULL;
+
+  G_LOCK (icons);
+
+  existing = g_hash_table_lookup (icons, filename);
+  if (existing) {
+    g_object_unref (pixbuf);
+    pixbuf = existing;
+  } else {
+    g_hash_table_insert (icons, g_strdup (filename), pixbuf);
+    dirty = TRUE;
+  }
+
+  g_object_ref (pixbuf);
+
+  G_UNLOCK (icons);
+
+  return pixbuf;
+}
+
+static guint32
+append (GByteArray *array, gconstpointer data, gsize length)
+{
+  guint32 offset;
+
+  /* Keep everything 4-byte aligned */
+  while (array->len % 4)
+    g_byte_array_append (array, (const guint8 *)"", 1);
+
+  offset = array->len;
+  g_byte_array_append (array, data, length);
+
+  return offset;
+}
+
+/*
+ * Write every icon decoded so far to the blob, if any icons had to be decoded.
+ */
+void
+bisho_icon_cache_save (void)
+{
+  GByteArray *array;
+  GHashTableIter iter;
+  IconHeader header;
+  IconEntry *entries;
+  GError *error = NULL;
+  gpointer key, value;
+  char *filename, *dirname;
+  guint i;
+
+  G_LOCK (icons);
+
+  if (!dirty || icons == NULL) {
+    G_UNLOCK (icons);
+    return;
+  }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, ICON_MAGIC, sizeof (header.magic));
+  header.version = ICON_VERSION;
+  header.n_entries = g_hash_table_size (icons);
+
+  array = g_byte_array_new ();
+  g_byte_array_set_size (array, sizeof (IconHeader) + header.n_entries * sizeof (IconEntry));
+  memset (array->data, 0, array->len);
+
+  entries = g_new0 (IconEntry, header.n_entries);
+
+  i = 0;
+  g_hash_table_iter_init (&iter, icons);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    GdkPixbuf *pixbuf = value;
+    IconEntry *entry = &entries[i++];
+    int height, rowstride;
+
+    height = gdk_pixbuf_get_height (pixbuf);
+    rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+    entry->mtime = get_mtime (key);
+    entry->filename = append (array, key, strlen (key) + 1);
+    entry->width = gdk_pixbuf_get_width (pixbuf);
+    entry->height = height;
+    entry->rowstride = rowstride;
+    entry->has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+    /* The last row may not be padded to the rowstride */
+    entry->pixels = append (array, gdk_pixbuf_get_pixels (pixbuf),
+                            rowstride * (height - 1)
+                            + entry->width * gdk_pixbuf_get_n_channels (pixbuf));
+  }
+
+  dirty = FALSE;
+
+  G_UNLOCK (icons);
+
+  memcpy (array->data, &header, sizeof (header));
+  memcpy (array->data + sizeof (IconHeader), entries, header.n_entries * sizeof (IconEntry));
+  g_free (entries);
+
+  filename = get_blob_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  /* This replaces the file, so the existing mapping remains valid */
+  if (!g_file_set_contents (filename, (char *)array->data, array->len, &error)) {
+    g_message ("Cannot write icon cache: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_free (filename);
+  g_byte_array_free (array, TRUE);
+}
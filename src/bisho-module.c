@@ -22,8 +22,15 @@
 #include <gmodule.h>
 #include "bisho-module.h"
 
+#define MANIFEST_GROUP "Bisho Module"
+
 G_DEFINE_TYPE (BishoModule, bisho_module, G_TYPE_TYPE_MODULE);
 
+/* Hash of auth type to the BishoModule that provides it, from the manifests.
+   Modules are loaded from the frame's worker threads, so this is locked. */
+G_LOCK_DEFINE_STATIC (modules);
+static GHashTable *manifest_modules = NULL;
+
 static gboolean
 bisho_module_load_module (GTypeModule *gmodule)
 {
@@ -45,6 +52,7 @@ bisho_module_load_module (GTypeModule *gmodule)
   if (!g_module_symbol (module->library, "bisho_module_load", (gpointer *) &module->load)) {
     g_printerr ("Module entrypoint missing: %s\n", g_module_error ());
     g_module_close (module->library);
+    module->library = NULL;
 
     return FALSE;
   }
@@ -101,3 +109,153 @@ bisho_module_new (const gchar *filename)
 
   return module;
 }
+
+static gboolean
+use_module (BishoModule *module)
+{
+  if (!g_type_module_use (G_TYPE_MODULE (module))) {
+    g_printerr ("Cannot load module %s\n", module->filename);
+    return FALSE;
+  }
+
+  g_type_module_unuse (G_TYPE_MODULE (module));
+
+  return TRUE;
+}
+
+/*
+ * Read the module manifests in @directory, so that the modules can be loaded
+ * when a service using them is shown.  Modules without a manifest are loaded
+ * immediately.
+ */
+void
+bisho_module_scan (const char *directory)
+{
+  GError *error = NULL;
+  GHashTable *described;
+  GSList *libraries = NULL, *l;
+  const char *name;
+  GDir *dir;
+
+  g_return_if_fail (directory);
+
+  dir = g_dir_open (directory, 0, &error);
+
+  if (!dir) {
+    if (error->domain != G_FILE_ERROR || error->code != G_FILE_ERROR_NOENT)
+      g_printerr ("Cannot open module directory: %s\n", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  G_LOCK (modules);
+
+  if (manifest_modules == NULL)
+    manifest_modules = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_object_unref);
+
+  /* Library filenames which have a manifest */
+  described = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  while ((name = g_dir_read_name (dir))) {
+    if (g_str_has_suffix (name, ".module")) {
+      GKeyFile *keys;
+      BishoModule *module;
+      char *path, *library, **auth_types;
+      int i;
+
+      path = g_build_filename (directory, name, NULL);
+      keys = g_key_file_new ();
+
+      if (!g_key_file_load_from_file (keys, path, G_KEY_FILE_NONE, &error)) {
+        g_printerr ("Cannot read module manifest %s: %s\n", path, error->message);
+        g_clear_error (&error);
+        g_key_file_free (keys);
+        g_free (path);
+        continue;
+      }
+      g_free (path);
+
+      library = g_key_file_get_string (keys, MANIFEST_GROUP, "Module", NULL);
+      auth_types = g_key_file_get_string_list (keys, MANIFEST_GROUP, "AuthTypes", NULL, NULL);
+      g_key_file_free (keys);
+
+      if (library == NULL || auth_types == NULL) {
+        g_printerr ("Invalid module manifest %s\n", name);
+        g_free (library);
+        g_strfreev (auth_types);
+        continue;
+      }
+
+      path = g_build_filename (directory, library, NULL);
+      module = bisho_module_new (path);
+      g_free (path);
+
+      for (i = 0; auth_types[i]; i++) {
+        g_hash_table_insert (manifest_modules,
+                             g_strdup (auth_types[i]),
+                             g_object_ref (module));
+      }
+
+      g_object_unref (module);
+      g_strfreev (auth_types);
+      g_hash_table_insert (described, library, GINT_TO_POINTER (TRUE));
+    } else if (g_str_has_suffix (name, ".so")) {
+      libraries = g_slist_prepend (libraries, g_strdup (name));
+    }
+  }
+
+  g_dir_close (dir);
+
+  for (l = libraries; l; l = l->next) {
+    if (!g_hash_table_lookup (described, l->data)) {
+      BishoModule *module;
+      char *path;
+
+      path = g_build_filename (directory, l->data, NULL);
+      module = bisho_module_new (path);
+      g_free (path);
+
+      if (!use_module (module))
+        g_object_unref (module);
+    }
+    g_free (l->data);
+  }
+
+  g_slist_free (libraries);
+  g_hash_table_destroy (described);
+
+  G_UNLOCK (modules);
+}
+
+/*
+ * Ensure that the module which provides panes for @auth_type is loaded.
+ * Returns TRUE if there is such a module and it is loaded.
+ */
+gboolean
+bisho_module_load_for_auth_type (const char *auth_type)
+{
+  BishoModule *module;
+  gboolean loaded = FALSE;
+
+  g_return_val_if_fail (auth_type, FALSE);
+
+  G_LOCK (modules);
+
+  if (manifest_modules == NULL)
+    goto done;
+
+  module = g_hash_table_lookup (manifest_modules, auth_type);
+  if (module == NULL)
+    goto done;
+
+  if (module->library)
+    loaded = TRUE;
+  else
+    loaded = use_module (module);
+
+ done:
+  G_UNLOCK (modules);
+
+  return loaded;
+}
@@ -53,6 +53,10 @@ BishoModule * bisho_module_new (const gchar *filename);
 
 void bisho_module_load (BishoModule *module);
 
+void bisho_module_scan (const char *directory);
+
+gboolean bisho_module_load_for_auth_type (const char *auth_type);
+
 G_END_DECLS
 
 #endif /* __BISHO_MODULE_H-_ */
@@ -22,6 +22,8 @@
 #include <gnome-keyring.h>
 #include <gtk/gtk.h>
 #include "bisho-pane-username.h"
+#include "bisho-trace.h"
+#include "bisho-utils.h"
 
 struct _BishoPaneUsernamePrivate {
   ServiceInfo *info; /* cached to speed access */
@@ -34,6 +36,9 @@ struct _BishoPaneUsernamePrivate {
   GtkWidget *logout_button;
   GtkWidget *username_e, *password_e;
   guint32 current_id; /* The keyring item ID of the current password */
+  gboolean saving; /* A keyring write is in progress */
+  gboolean save_pending; /* Log in was clicked again during the write */
+  gboolean remove_pending; /* Log out was clicked during the write */
 };
 
 enum {
@@ -66,29 +71,55 @@ add_banner (BishoPaneUsername *pane, gboolean success)
   g_free (message);
 }
 
+static void remove_done_cb (GnomeKeyringResult result, gpointer user_data);
+static void save_credentials (BishoPaneUsername *pane);
+
 static void
 keyring_op_done_cb (GnomeKeyringResult result,
-                    guint              new_id,
+                    guint32            new_id,
                     gpointer           user_data)
 {
   BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
+  BishoPaneUsernamePrivate *priv = pane->priv;
+
+  bisho_trace_async_end ("keyring_set", pane, priv->info->name);
+
+  priv->saving = FALSE;
 
   switch (result) {
   case GNOME_KEYRING_RESULT_OK:
-    pane->priv->current_id = new_id;
-    sw_client_service_credentials_updated (pane->priv->service);
+    priv->current_id = new_id;
     break;
   default:
     add_banner (pane, FALSE);
     g_warning (G_STRLOC ": Error setting keyring: %s", gnome_keyring_result_to_message (result));
     break;
   }
+
+  if (priv->remove_pending) {
+    /* Logged out while the password was being written */
+    priv->remove_pending = FALSE;
+    if (priv->current_id) {
+      bisho_trace_async_begin ("keyring_delete", pane, priv->info->name);
+      gnome_keyring_item_delete (NULL, priv->current_id, remove_done_cb,
+                                 g_object_ref (pane), g_object_unref);
+      priv->current_id = 0;
+    }
+  } else if (priv->save_pending) {
+    /* Write whatever is in the entries now, the intermediate values are moot */
+    priv->save_pending = FALSE;
+    save_credentials (pane);
+  } else if (result == GNOME_KEYRING_RESULT_OK) {
+    sw_client_service_credentials_updated (priv->service);
+    bisho_utils_reload_accounts ();
+  }
+
+  g_object_unref (pane);
 }
 
 static void
-on_login_clicked (GtkButton *button, gpointer user_data)
+save_credentials (BishoPaneUsername *pane)
 {
-  BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
   BishoPaneUsernamePrivate *priv = pane->priv;
   const char *username, *password;
 
@@ -98,16 +129,32 @@ on_login_clicked (GtkButton *button, gpointer user_data)
   else
     password = "";
 
-  /* Wipe the old data because we only support -- at the moment -- a single user */
-  gnome_keyring_item_delete_sync (NULL, priv->current_id);
-  priv->current_id = 0;
+  priv->saving = TRUE;
+
+  /*
+   * Only a single user is supported at the moment, so the new password replaces
+   * the old one.  The old item is kept until the new one has been written.
+   */
+  bisho_trace_async_begin ("keyring_set", pane, priv->info->name);
+  bisho_credentials_replace_network_password (bisho_pane_get_credentials (BISHO_PANE (pane)),
+                                              priv->current_id,
+                                              priv->info->auth.password.server,
+                                              username, password,
+                                              keyring_op_done_cb, g_object_ref (pane));
+}
 
-  gnome_keyring_set_network_password  (NULL,
-                                       username,
-                                       NULL,
-                                       priv->info->auth.password.server,
-                                       NULL, NULL, NULL, 0, password,
-                                       keyring_op_done_cb, pane, NULL);
+static void
+on_login_clicked (GtkButton *button, gpointer user_data)
+{
+  BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
+  BishoPaneUsernamePrivate *priv = pane->priv;
+
+  priv->remove_pending = FALSE;
+
+  if (priv->saving)
+    priv->save_pending = TRUE;
+  else
+    save_credentials (pane);
 
   /* If we are not watching for the verify signal, show the banner now */
   if (!pane->priv->can_verify) {
@@ -155,10 +202,13 @@ remove_done_cb (GnomeKeyringResult result,
 {
   BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
 
+  bisho_trace_async_end ("keyring_delete", pane, pane->priv->info->name);
+
   switch (result) {
   case GNOME_KEYRING_RESULT_OK:
   case GNOME_KEYRING_RESULT_NO_MATCH:
     sw_client_service_credentials_updated (pane->priv->service);
+    bisho_utils_reload_accounts ();
     break;
   default:
     g_warning (G_STRLOC ": Error from keyring: %s", gnome_keyring_result_to_message (result));
@@ -177,7 +227,15 @@ on_logout_clicked (GtkButton *button, gpointer user_data)
   if (priv->with_password)
     gtk_entry_set_text (GTK_ENTRY (priv->password_e), "");
 
-  gnome_keyring_item_delete (NULL, priv->current_id, remove_done_cb, pane, NULL);
+  /* The item being written is removed once its ID is known */
+  if (priv->saving) {
+    priv->save_pending = FALSE;
+    priv->remove_pending = TRUE;
+  }
+
+  bisho_trace_async_begin ("keyring_delete", pane, priv->info->name);
+  gnome_keyring_item_delete (NULL, priv->current_id, remove_done_cb,
+                             g_object_ref (pane), g_object_unref);
   priv->current_id = 0;
 
   message = g_strdup_printf (_("Log out succeeded. "
@@ -216,6 +274,8 @@ got_dynamic_caps_cb (SwClientService  *service,
 {
   BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
 
+  bisho_trace_async_end ("dynamic_caps", pane, pane->priv->info->name);
+
   if (error) {
     g_message ("Cannot get dynamic caps: %s", error->message);
     return;
@@ -234,6 +294,8 @@ got_static_caps_cb (SwClientService  *service,
 {
   BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
 
+  bisho_trace_async_end ("static_caps", pane, pane->priv->info->name);
+
   if (error) {
     g_message ("Cannot get static caps: %s", error->message);
     return;
@@ -242,6 +304,7 @@ got_static_caps_cb (SwClientService  *service,
   if (sw_client_service_has_cap (caps, CAN_VERIFY_CREDENTIALS)) {
     pane->priv->can_verify = TRUE;
     g_signal_connect (pane->priv->service, "capabilities-changed", G_CALLBACK (on_caps_changed), pane);
+    bisho_trace_async_begin ("dynamic_caps", pane, pane->priv->info->name);
     sw_client_service_get_dynamic_capabilities (pane->priv->service, got_dynamic_caps_cb, pane);
   }
 }
@@ -296,20 +359,24 @@ bisho_pane_username_init (BishoPaneUsername *self)
 
 static void
 found_password_cb (GnomeKeyringResult  result,
-                   GList              *list,
+                   guint32             item_id,
+                   const char         *user,
+                   const char         *secret,
                    gpointer            user_data)
 {
   BishoPaneUsername *pane = BISHO_PANE_USERNAME (user_data);
 
-  if (result == GNOME_KEYRING_RESULT_OK && list != NULL) {
-    GnomeKeyringNetworkPasswordData *data = list->data;
+  bisho_trace_async_end ("keyring_find", pane, pane->priv->info->name);
 
-    pane->priv->current_id = data->item_id;
+  if (result == GNOME_KEYRING_RESULT_OK) {
+    pane->priv->current_id = item_id;
 
-    gtk_entry_set_text (GTK_ENTRY (pane->priv->username_e), data->user);
+    gtk_entry_set_text (GTK_ENTRY (pane->priv->username_e), user ?: "");
     if (pane->priv->with_password)
-      gtk_entry_set_text (GTK_ENTRY (pane->priv->password_e), data->password);
+      gtk_entry_set_text (GTK_ENTRY (pane->priv->password_e), secret ?: "");
   }
+
+  bisho_pane_set_ready (BISHO_PANE (pane));
 }
 
 static void
@@ -325,6 +392,7 @@ bisho_pane_username_constructed (GObject *object)
 
   /* Get the static caps so we know how to handle credential validation */
   u_pane->priv->service = sw_client_get_service (pane->socialweb, priv->info->name);
+  bisho_trace_async_begin ("static_caps", u_pane, priv->info->name);
   sw_client_service_get_static_capabilities (u_pane->priv->service, got_static_caps_cb, u_pane);
 
   /* The username widgets */
@@ -359,10 +427,10 @@ bisho_pane_username_constructed (GObject *object)
   }
 
   /* Now fetch the username/password */
-  gnome_keyring_find_network_password (NULL, NULL,
-                                       priv->info->auth.password.server,
-                                       NULL, NULL, NULL, 0,
-                                       found_password_cb, pane, NULL);
+  bisho_trace_async_begin ("keyring_find", pane, priv->info->name);
+  bisho_credentials_find_network_password (bisho_pane_get_credentials (pane),
+                                           priv->info->auth.password.server,
+                                           found_password_cb, pane);
 }
 
 static void
@@ -21,14 +21,33 @@
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
 #include "bisho-pane.h"
+#include "bisho-state-cache.h"
+#include "bisho-trace.h"
 #include "mux-label.h"
 
 G_DEFINE_ABSTRACT_TYPE (BishoPane, bisho_pane, GTK_TYPE_VBOX);
 
+/* Kept out of BishoPane so that its layout is unchanged for pane modules */
+typedef struct {
+  BishoCredentials *credentials;
+  /* Whether the initial login state has been checked */
+  gboolean ready;
+} BishoPanePrivate;
+
+#define GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), BISHO_TYPE_PANE, BishoPanePrivate))
+
+enum {
+  READY,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
 enum {
   PROP_0,
   PROP_SERVICE,
-  PROP_SOCIALWEB
+  PROP_SOCIALWEB,
+  PROP_CREDENTIALS
 };
 
 static void
@@ -44,6 +63,9 @@ bisho_pane_get_property (GObject *object, guint property_id,
   case PROP_SOCIALWEB:
     g_value_set_object (value, pane->socialweb);
     break;
+  case PROP_CREDENTIALS:
+    g_value_set_pointer (value, GET_PRIVATE (pane)->credentials);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -62,7 +84,7 @@ bisho_pane_set_property (GObject *object, guint property_id,
       GtkTextIter end;
       char *s;
 
-      pane->info = g_value_get_pointer (value);
+      pane->info = service_info_ref (g_value_get_pointer (value));
       buffer = mux_label_get_buffer (MUX_LABEL (pane->description));
 
       if (pane->info->description) {
@@ -92,6 +114,10 @@ bisho_pane_set_property (GObject *object, guint property_id,
   case PROP_SOCIALWEB:
     pane->socialweb = g_value_dup_object (value);
     break;
+  case PROP_CREDENTIALS:
+    if (g_value_get_pointer (value))
+      GET_PRIVATE (pane)->credentials = bisho_credentials_ref (g_value_get_pointer (value));
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -101,6 +127,7 @@ static void
 bisho_pane_dispose (GObject *object)
 {
   BishoPane *pane = BISHO_PANE (object);
+  BishoPanePrivate *priv = GET_PRIVATE (pane);
 
   if (pane->banner_timeout != 0)
     {
@@ -108,10 +135,26 @@ bisho_pane_dispose (GObject *object)
       pane->banner_timeout = 0;
     }
 
+  if (priv->credentials)
+    {
+      bisho_credentials_unref (priv->credentials);
+      priv->credentials = NULL;
+    }
+
   G_OBJECT_CLASS (bisho_pane_parent_class)->dispose (object);
 
 }
 
+static void
+bisho_pane_finalize (GObject *object)
+{
+  BishoPane *pane = BISHO_PANE (object);
+
+  service_info_unref (pane->info);
+
+  G_OBJECT_CLASS (bisho_pane_parent_class)->finalize (object);
+}
+
 static void
 bisho_pane_class_init (BishoPaneClass *klass)
 {
@@ -121,6 +164,7 @@ bisho_pane_class_init (BishoPaneClass *klass)
     object_class->get_property = bisho_pane_get_property;
     object_class->set_property = bisho_pane_set_property;
     object_class->dispose = bisho_pane_dispose;
+    object_class->finalize = bisho_pane_finalize;
 
     pspec = g_param_spec_pointer ("service", "service", "service",
                                   G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
@@ -130,6 +174,19 @@ bisho_pane_class_init (BishoPaneClass *klass)
                                  SW_TYPE_CLIENT,
                                  G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
     g_object_class_install_property (object_class, PROP_SOCIALWEB, pspec);
+
+    pspec = g_param_spec_pointer ("credentials", "credentials", "credentials",
+                                  G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_property (object_class, PROP_CREDENTIALS, pspec);
+
+    signals[READY] = g_signal_new ("ready",
+                                   G_TYPE_FROM_CLASS (klass),
+                                   G_SIGNAL_RUN_LAST,
+                                   0, NULL, NULL,
+                                   g_cclosure_marshal_VOID__VOID,
+                                   G_TYPE_NONE, 0);
+
+    g_type_class_add_private (klass, sizeof (BishoPanePrivate));
 }
 
 static void
@@ -285,6 +342,18 @@ on_online_changed (SwClient *client, gboolean online, gpointer user_data)
   gtk_widget_set_sensitive (widget, online);
 }
 
+/*
+ * Get the credentials index the pane should look its keyring items up in, or
+ * NULL to query the keyring directly.
+ */
+BishoCredentials *
+bisho_pane_get_credentials (BishoPane *pane)
+{
+  g_return_val_if_fail (BISHO_IS_PANE (pane), NULL);
+
+  return GET_PRIVATE (pane)->credentials;
+}
+
 void
 bisho_pane_follow_connected (BishoPane *pane, GtkWidget *widget)
 {
@@ -295,3 +364,54 @@ bisho_pane_follow_connected (BishoPane *pane, GtkWidget *widget)
 
   sw_client_is_online (pane->socialweb, on_online_changed, widget);
 }
+
+/*
+ * Get the login state of the service when bisho last ran, so that it can be
+ * shown while the real state is checked.  Returns FALSE if it isn't known.
+ */
+gboolean
+bisho_pane_get_cached_state (BishoPane *pane, gboolean *logged_in, char **icon, char **username)
+{
+  g_return_val_if_fail (BISHO_IS_PANE (pane), FALSE);
+
+  return bisho_state_cache_lookup (pane->info->name, logged_in, icon, username);
+}
+
+/*
+ * Remember the login state of the service for the next time bisho runs.
+ */
+void
+bisho_pane_set_cached_state (BishoPane *pane, gboolean logged_in, const char *icon, const char *username)
+{
+  g_return_if_fail (BISHO_IS_PANE (pane));
+
+  bisho_state_cache_update (pane->info->name, logged_in, icon, username);
+}
+
+/*
+ * Called by the pane when it has finished checking the login state it was
+ * constructed with, successfully or not.  Emits "ready" the first time.
+ */
+void
+bisho_pane_set_ready (BishoPane *pane)
+{
+  BishoPanePrivate *priv;
+
+  g_return_if_fail (BISHO_IS_PANE (pane));
+
+  priv = GET_PRIVATE (pane);
+  if (priv->ready)
+    return;
+
+  priv->ready = TRUE;
+  bisho_trace_instant ("pane_ready", pane->info->name);
+  g_signal_emit (pane, signals[READY], 0);
+}
+
+gboolean
+bisho_pane_is_ready (BishoPane *pane)
+{
+  g_return_val_if_fail (BISHO_IS_PANE (pane), FALSE);
+
+  return GET_PRIVATE (pane)->ready;
+}
@@ -3,6 +3,7 @@
 
 #include <gtk/gtk.h>
 #include "service-info.h"
+#include "bisho-credentials.h"
 #include <libsocialweb-client/sw-client.h>
 
 G_BEGIN_DECLS
@@ -56,8 +57,18 @@ void bisho_pane_set_banner_error (BishoPane *pane, const GError *error);
 
 void bisho_pane_set_user (BishoPane *pane, const char *icon, const char *username);
 
+BishoCredentials * bisho_pane_get_credentials (BishoPane *pane);
+
 void bisho_pane_follow_connected (BishoPane *pane, GtkWidget *widget);
 
+gboolean bisho_pane_get_cached_state (BishoPane *pane, gboolean *logged_in, char **icon, char **username);
+
+void bisho_pane_set_cached_state (BishoPane *pane, gboolean logged_in, const char *icon, const char *username);
+
+void bisho_pane_set_ready (BishoPane *pane);
+
+gboolean bisho_pane_is_ready (BishoPane *pane);
+
 G_END_DECLS
 
 #endif /* __BISHO_PANE_H__ */
@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the network calls made by the panes.  Every call has a deadline, each
+ * attempt is cut off if it takes too long, transient failures are retried
+ * with a jittered exponential backoff (or after the delay the server asked for
+ * with Retry-After), and only a few calls are in flight at once, and fewer to
+ * any one host.  librest doesn't expose its SoupSession, so this is where the
+ * connections per host are limited.  The caller only hears about the final
+ * result, which is reported like any other error from librest.
+ *
+ * Only used from the main thread.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <time.h>
+#include <glib/gi18n-lib.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+#include <rest/rest-proxy.h>
+#include "bisho-trace.h"
+#include "bisho-scheduler.h"
+
+/* Calls in flight at once, and to a single host */
+#define MAX_IN_FLIGHT 4
+#define MAX_PER_HOST 2
+/* Attempts at a call before giving up */
+#define MAX_ATTEMPTS 5
+/* Seconds before an attempt is cut off */
+#define ATTEMPT_TIMEOUT 20
+/* Seconds to wait after the first and at most after any failure */
+#define BACKOFF_BASE 1
+#define BACKOFF_MAX 30
+/* Longest Retry-After in seconds that is honoured instead of giving up */
+#define RETRY_AFTER_MAX 120
+
+#define HTTP_TOO_MANY_REQUESTS 429
+
+typedef struct {
+  RestProxyCall *call;
+  RestProxyCallAsyncCallback callback;
+  GObject *weak_object;
+  gpointer user_data;
+  /* The host the proxy talks to, or "" if unknown */
+  char *host;
+  /* Whether the call can be sent again after it may have reached the server */
+  gboolean idempotent;
+  gint64 deadline;
+  guint attempt;
+  guint timeout_id;
+  guint retry_id;
+  gboolean in_flight;
+  gboolean timed_out;
+  gboolean cancelled;
+} Request;
+
+/* RestProxyCall to Request */
+static GHashTable *requests = NULL;
+/* Requests waiting for a slot */
+static GQueue waiting = G_QUEUE_INIT;
+static guint in_flight = 0;
+/* Hash of host to the number of calls in flight to it */
+static GHashTable *hosts = NULL;
+static guint dispatch_id = 0;
+
+static void weak_notify (gpointer data, GObject *where_the_object_was);
+
+static void
+request_free (Request *request)
+{
+  if (request->weak_object)
+    g_object_weak_unref (request->weak_object, weak_notify, request);
+
+  if (request->timeout_id)
+    g_source_remove (request->timeout_id);
+
+  if (request->retry_id)
+    g_source_remove (request->retry_id);
+
+  g_object_unref (request->call);
+  g_free (request->host);
+  g_slice_free (Request, request);
+}
+
+static char *
+get_host (RestProxyCall *call)
+{
+  RestProxy *proxy = NULL;
+  SoupURI *uri = NULL;
+  char *url = NULL, *host = NULL;
+
+  g_object_get (call, "proxy", &proxy, NULL);
+  if (proxy) {
+    g_object_get (proxy, "url-format", &url, NULL);
+    g_object_unref (proxy);
+  }
+
+  if (url)
+    uri = soup_uri_new (url);
+  if (uri) {
+    host = g_strdup (uri->host);
+    soup_uri_free (uri);
+  }
+
+  g_free (url);
+
+  return host ? host : g_strdup ("");
+}
+
+static guint
+get_host_in_flight (const char *host)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (hosts, host));
+}
+
+static void
+add_host_in_flight (const char *host, int delta)
+{
+  g_hash_table_replace (hosts, g_strdup (host),
+                        GUINT_TO_POINTER (get_host_in_flight (host) + delta));
+}
+
+/* Report the final result of @request to the caller and free it */
+static void
+finish (Request *request, const GError *error)
+{
+  g_hash_table_remove (requests, request->call);
+
+  request->callback (request->call, error, request->weak_object, request->user_data);
+
+  request_free (request);
+}
+
+static void
+cancel_request (Request *request)
+{
+  if (request->cancelled)
+    return;
+
+  request->cancelled = TRUE;
+
+  g_hash_table_remove (requests, request->call);
+  g_queue_remove (&waiting, request);
+
+  if (request->in_flight) {
+    /* The request is freed when librest reports the cancellation */
+    rest_proxy_call_cancel (request->call);
+  } else {
+    request_free (request);
+  }
+}
+
+static void
+weak_notify (gpointer data, GObject *where_the_object_was)
+{
+  Request *request = data;
+
+  request->weak_object = NULL;
+  cancel_request (request);
+}
+
+/*
+ * Whether @request should be tried again after failing with @error.  Calls
+ * which aren't idempotent are only retried when the server can't have acted
+ * on them: the host couldn't be reached, or it refused to handle the call.
+ */
+static gboolean
+is_transient (Request *request, const GError *error)
+{
+  if (error->domain != REST_PROXY_ERROR)
+    return FALSE;
+
+  switch (error->code) {
+  case REST_PROXY_ERROR_RESOLUTION:
+  case REST_PROXY_ERROR_CONNECTION:
+  case HTTP_TOO_MANY_REQUESTS:
+  case REST_PROXY_ERROR_HTTP_SERVICE_UNAVAILABLE:
+    return TRUE;
+  case REST_PROXY_ERROR_IO:
+  case REST_PROXY_ERROR_HTTP_REQUEST_TIMEOUT:
+  case REST_PROXY_ERROR_HTTP_INTERNAL_SERVER_ERROR:
+  case REST_PROXY_ERROR_HTTP_BAD_GATEWAY:
+  case REST_PROXY_ERROR_HTTP_GATEWAY_TIMEOUT:
+    return request->idempotent;
+  default:
+    return FALSE;
+  }
+}
+
+/* The delay in seconds the server asked for, or -1 */
+static int
+get_retry_after (RestProxyCall *call)
+{
+  const char *header;
+  SoupDate *date;
+  int seconds;
+
+  header = rest_proxy_call_lookup_response_header (call, "Retry-After");
+  if (header == NULL)
+    return -1;
+
+  if (g_ascii_isdigit (header[0]))
+    return MIN (atoi (header), G_MAXINT / 1000);
+
+  date = soup_date_new_from_string (header);
+  if (date == NULL)
+    return -1;
+
+  seconds = MAX (soup_date_to_time_t (date) - time (NULL), 0);
+  soup_date_free (date);
+
+  return seconds;
+}
+
+/* The delay in milliseconds before the next attempt at @request */
+static guint
+get_backoff (Request *request)
+{
+  guint delay;
+
+  delay = BACKOFF_BASE * 1000 << MIN (request->attempt - 1, 16);
+  delay = MIN (delay, BACKOFF_MAX * 1000);
+
+  /* Spread out the panes that failed together */
+  return g_random_int_range (delay / 2, delay + 1);
+}
+
+static gboolean dispatch_cb (gpointer user_data);
+
+static void
+schedule_dispatch (void)
+{
+  if (dispatch_id == 0)
+    dispatch_id = g_idle_add (dispatch_cb, NULL);
+}
+
+static gboolean
+retry_cb (gpointer user_data)
+{
+  Request *request = user_data;
+
+  request->retry_id = 0;
+
+  /* Retries go ahead of calls that haven't been tried yet */
+  g_queue_push_head (&waiting, request);
+  schedule_dispatch ();
+
+  return FALSE;
+}
+
+static gboolean
+attempt_timeout_cb (gpointer user_data)
+{
+  Request *request = user_data;
+
+  request->timeout_id = 0;
+  request->timed_out = TRUE;
+
+  /* call_cb() is called with the cancellation */
+  rest_proxy_call_cancel (request->call);
+
+  return FALSE;
+}
+
+static void
+call_cb (RestProxyCall *call, const GError *error, GObject *weak_object, gpointer user_data)
+{
+  Request *request = user_data;
+  GError *timeout_error = NULL;
+  gint64 now;
+  guint delay;
+  int retry_after;
+
+  bisho_trace_async_end ("network_call", request, NULL);
+
+  request->in_flight = FALSE;
+  in_flight--;
+  add_host_in_flight (request->host, -1);
+  schedule_dispatch ();
+
+  if (request->timeout_id) {
+    g_source_remove (request->timeout_id);
+    request->timeout_id = 0;
+  }
+
+  if (request->cancelled) {
+    request_free (request);
+    return;
+  }
+
+  if (error == NULL) {
+    finish (request, NULL);
+    return;
+  }
+
+  if (request->timed_out) {
+    error = timeout_error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                                 _("The connection timed out."));
+    /* The server may have handled it, and just not answered in time */
+    if (!request->idempotent) {
+      finish (request, error);
+      goto done;
+    }
+  } else if (!is_transient (request, error)) {
+    finish (request, error);
+    return;
+  }
+
+  delay = get_backoff (request);
+  retry_after = get_retry_after (call);
+  if (retry_after > RETRY_AFTER_MAX) {
+    finish (request, error);
+    goto done;
+  }
+  if (retry_after >= 0)
+    delay = MAX (delay, (guint)retry_after * 1000);
+
+  now = g_get_monotonic_time ();
+  if (request->attempt >= MAX_ATTEMPTS ||
+      now + (gint64)delay * 1000 >= request->deadline) {
+    finish (request, error);
+    goto done;
+  }
+
+  g_message ("Network call failed, retrying in %ums: %s", delay, error->message);
+  bisho_trace_instant ("network_retry", error->message);
+  request->retry_id = g_timeout_add (delay, retry_cb, request);
+
+ done:
+  if (timeout_error)
+    g_error_free (timeout_error);
+}
+
+static void
+start_attempt (Request *request)
+{
+  GError *error = NULL;
+  gint64 remaining;
+
+  remaining = request->deadline - g_get_monotonic_time ();
+  if (remaining <= 0) {
+    error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                 _("The connection timed out."));
+    finish (request, error);
+    g_error_free (error);
+    return;
+  }
+
+  /*
+   * Preparing a FlickrProxyCall adds its signature as the api_sig parameter,
+   * which would otherwise be signed over by the next attempt and make the
+   * signature wrong.  OAuth signatures go in a header which is replaced.
+   */
+  if (request->attempt > 0)
+    rest_proxy_call_remove_param (request->call, "api_sig");
+
+  request->attempt++;
+  request->timed_out = FALSE;
+
+  if (!rest_proxy_call_async (request->call, call_cb, NULL, request, &error)) {
+    finish (request, error);
+    g_error_free (error);
+    return;
+  }
+
+  bisho_trace_async_begin ("network_call", request, NULL);
+  request->in_flight = TRUE;
+  in_flight++;
+  add_host_in_flight (request->host, 1);
+
+  remaining = MIN (remaining / 1000, ATTEMPT_TIMEOUT * 1000);
+  request->timeout_id = g_timeout_add (remaining, attempt_timeout_cb, request);
+}
+
+/* The first waiting request whose host has a free slot, or NULL */
+static GList *
+find_startable (void)
+{
+  GList *l;
+
+  for (l = waiting.head; l; l = l->next) {
+    Request *request = l->data;
+
+    if (get_host_in_flight (request->host) < MAX_PER_HOST)
+      return l;
+  }
+
+  return NULL;
+}
+
+static gboolean
+dispatch_cb (gpointer user_data)
+{
+  GList *l;
+
+  dispatch_id = 0;
+
+  /* Starting a call can finish and queue others, so search again each time */
+  while (in_flight < MAX_IN_FLIGHT && (l = find_startable ())) {
+    Request *request = l->data;
+
+    g_queue_delete_link (&waiting, l);
+    start_attempt (request);
+  }
+
+  return FALSE;
+}
+
+/*
+ * Invoke @call, retrying transient failures until @deadline seconds have
+ * passed (or BISHO_SCHEDULER_DEFAULT_DEADLINE if 0).  Unless @idempotent,
+ * @call is only sent again if it cannot have reached the server, so pass FALSE
+ * for calls that use up single-use tokens.  @callback is called once
+ * with the final result, unless the call is cancelled with
+ * bisho_scheduler_cancel() or @weak_object is destroyed first.  The caller
+ * keeps its reference to @call.
+ */
+void
+bisho_scheduler_call_async (RestProxyCall *call,
+                            guint deadline,
+                            gboolean idempotent,
+                            RestProxyCallAsyncCallback callback,
+                            GObject *weak_object,
+                            gpointer user_data)
+{
+  Request *request;
+
+  g_return_if_fail (REST_IS_PROXY_CALL (call));
+  g_return_if_fail (callback);
+
+  if (requests == NULL) {
+    requests = g_hash_table_new (NULL, NULL);
+    hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  }
+
+  g_return_if_fail (g_hash_table_lookup (requests, call) == NULL);
+
+  request = g_slice_new0 (Request);
+  request->call = g_object_ref (call);
+  request->callback = callback;
+  request->weak_object = weak_object;
+  request->user_data = user_data;
+  request->host = get_host (call);
+  request->idempotent = idempotent;
+  request->deadline = g_get_monotonic_time () +
+    (gint64)(deadline ?: BISHO_SCHEDULER_DEFAULT_DEADLINE) * G_USEC_PER_SEC;
+
+  if (weak_object)
+    g_object_weak_ref (weak_object, weak_notify, request);
+
+  g_hash_table_insert (requests, call, request);
+  g_queue_push_tail (&waiting, request);
+  schedule_dispatch ();
+}
+
+/*
+ * Stop @call, wherever it is in the queue.  Its callback will not be called.
+ */
+void
+bisho_scheduler_cancel (RestProxyCall *call)
+{
+  Request *request;
+
+  if (requests == NULL)
+    return;
+
+  request = g_hash_table_lookup (requests, call);
+  if (request)
+    cancel_request (request);
+}
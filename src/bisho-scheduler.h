@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BISHO_SCHEDULER_H__
+#define __BISHO_SCHEDULER_H__
+
+#include <rest/rest-proxy-call.h>
+
+G_BEGIN_DECLS
+
+/* Seconds a call may take, including retries, when no deadline is given */
+#define BISHO_SCHEDULER_DEFAULT_DEADLINE 60
+
+void bisho_scheduler_call_async (RestProxyCall *call,
+                                 guint deadline,
+                                 gboolean idempotent,
+                                 RestProxyCallAsyncCallback callback,
+                                 GObject *weak_object,
+                                 gpointer user_data);
+
+void bisho_scheduler_cancel (RestProxyCall *call);
+
+G_END_DECLS
+
+#endif /* __BISHO_SCHEDULER_H__ */
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The last known login state of each service, so that panes can show it as
+ * soon as they are built and then check it against the keyring and the
+ * network.  The file is a key file with a group for each service, and is only
+ * used from the main thread.  Other processes (the capplet and the daemon) may
+ * update it too, so only the groups changed here are merged into the file.
+ */
+
+#include <config.h>
+#include <glib.h>
+#include "bisho-state-cache.h"
+
+static GKeyFile *state = NULL;
+static guint save_id = 0;
+/* Set of the services changed since the file was last written */
+static GHashTable *changed_services = NULL;
+
+static char *
+get_state_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "bisho", "state.ini", NULL);
+}
+
+static GKeyFile *
+get_state (void)
+{
+  char *filename;
+
+  if (state)
+    return state;
+
+  state = g_key_file_new ();
+
+  filename = get_state_filename ();
+  /* A missing or corrupt file just means an empty cache */
+  g_key_file_load_from_file (state, filename, G_KEY_FILE_NONE, NULL);
+  g_free (filename);
+
+  return state;
+}
+
+/* Replace the group for @service in @keys with the one in the local state */
+static void
+merge_service (const char *service, gpointer value, GKeyFile *keys)
+{
+  char **names;
+  char *s;
+  int i;
+
+  g_key_file_remove_group (keys, service, NULL);
+
+  names = g_key_file_get_keys (state, service, NULL, NULL);
+  if (names == NULL)
+    return;
+
+  for (i = 0; names[i]; i++) {
+    s = g_key_file_get_value (state, service, names[i], NULL);
+    g_key_file_set_value (keys, service, names[i], s);
+    g_free (s);
+  }
+
+  g_strfreev (names);
+}
+
+static gboolean
+save_idle (gpointer user_data)
+{
+  char *filename, *dirname, *data;
+  GKeyFile *keys;
+  GError *error = NULL;
+  gsize length;
+
+  save_id = 0;
+
+  filename = get_state_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  /* Re-read the file so that changes from other processes are kept */
+  keys = g_key_file_new ();
+  g_key_file_load_from_file (keys, filename, G_KEY_FILE_NONE, NULL);
+  g_hash_table_foreach (changed_services, (GHFunc)merge_service, keys);
+  g_hash_table_remove_all (changed_services);
+
+  data = g_key_file_to_data (keys, &length, NULL);
+  if (!g_file_set_contents (filename, data, length, &error)) {
+    g_message ("Cannot write login state cache: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_free (data);
+  g_key_file_free (keys);
+  g_free (filename);
+
+  return FALSE;
+}
+
+/*
+ * Get the login state of @service when it was last seen.  Returns FALSE if it
+ * isn't known.  @icon and @username should be freed.
+ */
+gboolean
+bisho_state_cache_lookup (const char *service,
+                          gboolean   *logged_in,
+                          char      **icon,
+                          char      **username)
+{
+  GKeyFile *keys = get_state ();
+  GError *error = NULL;
+  gboolean value;
+
+  g_return_val_if_fail (service, FALSE);
+
+  value = g_key_file_get_boolean (keys, service, "LoggedIn", &error);
+  if (error) {
+    g_error_free (error);
+    return FALSE;
+  }
+
+  if (logged_in)
+    *logged_in = value;
+  if (icon)
+    *icon = g_key_file_get_string (keys, service, "Icon", NULL);
+  if (username)
+    *username = g_key_file_get_string (keys, service, "UserName", NULL);
+
+  return TRUE;
+}
+
+static gboolean
+update_string (GKeyFile *keys, const char *service, const char *key, const char *value)
+{
+  char *old;
+  gboolean changed;
+
+  old = g_key_file_get_string (keys, service, key, NULL);
+  changed = g_strcmp0 (old, value) != 0;
+  g_free (old);
+
+  if (!changed)
+    return FALSE;
+
+  if (value)
+    g_key_file_set_string (keys, service, key, value);
+  else
+    g_key_file_remove_key (keys, service, key, NULL);
+
+  return TRUE;
+}
+
+/*
+ * Remember the login state of @service.  The file is only written if something
+ * changed, from an idle callback.
+ */
+void
+bisho_state_cache_update (const char *service,
+                          gboolean    logged_in,
+                          const char *icon,
+                          const char *username)
+{
+  GKeyFile *keys = get_state ();
+  GError *error = NULL;
+  gboolean changed = FALSE;
+
+  g_return_if_fail (service);
+
+  if (g_key_file_get_boolean (keys, service, "LoggedIn", &error) != logged_in || error) {
+    g_key_file_set_boolean (keys, service, "LoggedIn", logged_in);
+    changed = TRUE;
+  }
+  g_clear_error (&error);
+
+  changed |= update_string (keys, service, "Icon", icon);
+  changed |= update_string (keys, service, "UserName", username);
+
+  if (!changed)
+    return;
+
+  if (changed_services == NULL)
+    changed_services = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_insert (changed_services, g_strdup (service), NULL);
+
+  if (save_id == 0)
+    save_id = g_idle_add_full (G_PRIORITY_LOW, save_idle, NULL, NULL);
+}
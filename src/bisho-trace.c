@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Opt-in tracing of startup phases and pane operations.  Set BISHO_TRACE to a
+ * filename and a trace in the Chrome trace event format is written there when
+ * the process exits, which can be loaded in chrome://tracing or Perfetto.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib.h>
+#include "bisho-trace.h"
+
+typedef struct {
+  char phase;
+  const char *name;
+  const char *detail;
+  gconstpointer id;
+  guint tid;
+  gint64 timestamp;
+} TraceEvent;
+
+G_LOCK_DEFINE_STATIC (trace);
+static char *trace_filename = NULL;
+static GArray *events = NULL;
+/* Hash of GThread to a small thread identifier */
+static GHashTable *threads = NULL;
+
+static void
+write_string (FILE *f, const char *s)
+{
+  fputc ('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf (f, "\\%c", *s);
+    else if ((guchar)*s < 0x20)
+      fprintf (f, "\\u%04x", *s);
+    else
+      fputc (*s, f);
+  }
+  fputc ('"', f);
+}
+
+static void
+write_trace (void)
+{
+  FILE *f;
+  guint i;
+  int pid;
+
+  G_LOCK (trace);
+
+  f = fopen (trace_filename, "w");
+  if (f == NULL) {
+    g_printerr ("Cannot write trace to %s\n", trace_filename);
+    G_UNLOCK (trace);
+    return;
+  }
+
+  pid = getpid ();
+
+  fputs ("{\"traceEvents\":[\n", f);
+
+  for (i = 0; i < events->len; i++) {
+    TraceEvent *event = &g_array_index (events, TraceEvent, i);
+
+    fprintf (f, "{\"ph\":\"%c\",\"cat\":\"bisho\",\"pid\":%d,\"tid\":%u,\"ts\":%" G_GINT64_FORMAT ",\"name\":",
+             event->phase, pid, event->tid, event->timestamp);
+    write_string (f, event->name);
+
+    if (event->phase == 'b' || event->phase == 'e')
+      fprintf (f, ",\"id\":\"%p\"", event->id);
+    else if (event->phase == 'i')
+      fputs (",\"s\":\"p\"", f);
+
+    if (event->detail) {
+      fputs (",\"args\":{\"detail\":", f);
+      write_string (f, event->detail);
+      fputc ('}', f);
+    }
+
+    fputs (i + 1 < events->len ? "},\n" : "}\n", f);
+  }
+
+  fputs ("]}\n", f);
+  fclose (f);
+
+  G_UNLOCK (trace);
+}
+
+static gpointer
+trace_init (gpointer data)
+{
+  const char *filename;
+
+  filename = g_getenv ("BISHO_TRACE");
+  if (filename == NULL || filename[0] == '\0')
+    return GINT_TO_POINTER (FALSE);
+
+  trace_filename = g_strdup (filename);
+  events = g_array_new (FALSE, FALSE, sizeof (TraceEvent));
+  threads = g_hash_table_new (NULL, NULL);
+
+  atexit (write_trace);
+
+  return GINT_TO_POINTER (TRUE);
+}
+
+gboolean
+bisho_trace_enabled (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, trace_init, NULL);
+
+  return GPOINTER_TO_INT (once.retval);
+}
+
+static void
+add_event (char phase, const char *name, gconstpointer id, const char *detail)
+{
+  TraceEvent event;
+  gpointer self;
+
+  if (!bisho_trace_enabled ())
+    return;
+
+  event.phase = phase;
+  event.name = g_intern_string (name);
+  event.detail = detail ? g_intern_string (detail) : NULL;
+  event.id = id;
+  event.timestamp = g_get_monotonic_time ();
+
+  G_LOCK (trace);
+
+  self = g_thread_self ();
+  event.tid = GPOINTER_TO_UINT (g_hash_table_lookup (threads, self));
+  if (event.tid == 0) {
+    event.tid = g_hash_table_size (threads) + 1;
+    g_hash_table_insert (threads, self, GUINT_TO_POINTER (event.tid));
+  }
+
+  g_array_append_val (events, event);
+
+  G_UNLOCK (trace);
+}
+
+/* Mark the start of a phase on the current thread */
+void
+bisho_trace_begin (const char *name, const char *detail)
+{
+  add_event ('B', name, NULL, detail);
+}
+
+void
+bisho_trace_end (const char *name, const char *detail)
+{
+  add_event ('E', name, NULL, detail);
+}
+
+/* Mark the start of an asynchronous operation, identified by @id */
+void
+bisho_trace_async_begin (const char *name, gconstpointer id, const char *detail)
+{
+  add_event ('b', name, id, detail);
+}
+
+void
+bisho_trace_async_end (const char *name, gconstpointer id, const char *detail)
+{
+  add_event ('e', name, id, detail);
+}
+
+void
+bisho_trace_instant (const char *name, const char *detail)
+{
+  add_event ('i', name, NULL, detail);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BISHO_TRACE_H__
+#define __BISHO_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean bisho_trace_enabled (void);
+
+void bisho_trace_begin (const char *name, const char *detail);
+
+void bisho_trace_end (const char *name, const char *detail);
+
+void bisho_trace_async_begin (const char *name, gconstpointer id, const char *detail);
+
+void bisho_trace_async_end (const char *name, gconstpointer id, const char *detail);
+
+void bisho_trace_instant (const char *name, const char *detail);
+
+G_END_DECLS
+
+#endif /* __BISHO_TRACE_H__ */
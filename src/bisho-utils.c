@@ -20,41 +20,85 @@
 #include <string.h>
 #include <gtk/gtk.h>
 #include "mux-expanding-item.h"
+#include "bisho-daemon.h"
 #include "bisho-utils.h"
 
-static GList *expander_list = NULL;
+/* A set of expanders of which only one is open at a time */
+struct _BishoExpanderGroup {
+  /* The open expander, or NULL */
+  MuxExpandingItem *active;
+};
+
+static void
+set_active (BishoExpanderGroup *group, MuxExpandingItem *item)
+{
+  if (group->active)
+    g_object_remove_weak_pointer (G_OBJECT (group->active), (gpointer *)&group->active);
+
+  group->active = item;
+
+  if (item)
+    g_object_add_weak_pointer (G_OBJECT (item), (gpointer *)&group->active);
+}
 
 static void
 expanded_cb (GObject *object, GParamSpec *param_spec, gpointer user_data)
 {
-  MuxExpandingItem *just_expanded = MUX_EXPANDING_ITEM (object);
-  GList *l;
-
-  if (mux_expanding_item_get_active (just_expanded)) {
-    for (l = expander_list; l; l = l->next) {
-      MuxExpandingItem *expander = l->data;
-      if (expander != just_expanded && mux_expanding_item_get_active (expander))
-        mux_expanding_item_set_active (expander, FALSE);
-    }
+  BishoExpanderGroup *group = user_data;
+  MuxExpandingItem *item = MUX_EXPANDING_ITEM (object);
+  MuxExpandingItem *previous;
+
+  if (mux_expanding_item_get_active (item)) {
+    previous = group->active;
+    if (previous == item)
+      return;
+
+    set_active (group, item);
+
+    /* This re-enters expanded_cb() but the group no longer points at it */
+    if (previous)
+      mux_expanding_item_set_active (previous, FALSE);
+  } else if (group->active == item) {
+    set_active (group, NULL);
   }
 }
 
-static void
-item_finalized_cb (gpointer data, GObject *object)
+BishoExpanderGroup *
+bisho_expander_group_new (void)
 {
-  expander_list = g_list_remove (expander_list, object);
+  return g_slice_new0 (BishoExpanderGroup);
 }
 
+/*
+ * Free @group.  The expanders in it should have been destroyed already.
+ */
 void
-bisho_utils_make_exclusive_expander (MuxExpandingItem *item)
+bisho_expander_group_free (BishoExpanderGroup *group)
 {
-  g_return_if_fail (MUX_IS_EXPANDING_ITEM (item));
+  if (group == NULL)
+    return;
 
-  expander_list = g_list_prepend (expander_list, item);
+  set_active (group, NULL);
+  g_slice_free (BishoExpanderGroup, group);
+}
 
-  g_object_weak_ref (G_OBJECT (item), item_finalized_cb, NULL);
+/*
+ * Add @item to @group, so that expanding it collapses whichever other expander
+ * in the group is open.
+ */
+void
+bisho_expander_group_add (BishoExpanderGroup *group, MuxExpandingItem *item)
+{
+  g_return_if_fail (group);
+  g_return_if_fail (MUX_IS_EXPANDING_ITEM (item));
+
+  if (mux_expanding_item_get_active (item)) {
+    if (group->active)
+      mux_expanding_item_set_active (group->active, FALSE);
+    set_active (group, item);
+  }
 
-  g_signal_connect (item, "notify::expanded", G_CALLBACK (expanded_cb), NULL);
+  g_signal_connect (item, "notify::expanded", G_CALLBACK (expanded_cb), group);
 }
 
 char *
@@ -76,3 +120,29 @@ bisho_utils_encode_tokens (const char *token, const char *secret)
 
   return string;
 }
+
+/*
+ * Ask the accounts daemon to read the login states again after credentials
+ * have been changed.  The daemon isn't started if it isn't already running, as
+ * it will read the current state when it does start.  No reply is waited for.
+ */
+void
+bisho_utils_reload_accounts (void)
+{
+  GDBusConnection *connection;
+  GError *error = NULL;
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (connection == NULL) {
+    g_message ("Cannot connect to the session bus: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  g_dbus_connection_call (connection, BISHO_DAEMON_NAME, BISHO_DAEMON_PATH,
+                          BISHO_DAEMON_INTERFACE, "Reload", NULL, NULL,
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START, -1,
+                          NULL, NULL, NULL);
+
+  g_object_unref (connection);
+}
@@ -25,10 +25,18 @@
 
 G_BEGIN_DECLS
 
-void bisho_utils_make_exclusive_expander (MuxExpandingItem *item);
+typedef struct _BishoExpanderGroup BishoExpanderGroup;
+
+BishoExpanderGroup * bisho_expander_group_new (void);
+
+void bisho_expander_group_free (BishoExpanderGroup *group);
+
+void bisho_expander_group_add (BishoExpanderGroup *group, MuxExpandingItem *item);
 
 char * bisho_utils_encode_tokens (const char *token, const char *secret);
 
+void bisho_utils_reload_accounts (void);
+
 G_END_DECLS
 
 #endif /* __BISHO_UTILS_H__ */
@@ -23,11 +23,51 @@
 #include <unique/unique.h>
 #include <libsoup/soup.h>
 #include "bisho-window.h"
+#include "bisho-cli.h"
+#include "bisho-daemon.h"
+#include "bisho-trace.h"
 
 enum {
   COMMAND_CALLBACK = 1
 };
 
+/* Where the running window accepts callback URIs, without libunique */
+#define CALLBACK_NAME "com.intel.Bisho.Callback"
+#define CALLBACK_PATH "/com/intel/Bisho/Callback"
+#define CALLBACK_INTERFACE "com.intel.Bisho.Callback"
+
+static const char callback_xml[] =
+  "<node>"
+  "  <interface name='" CALLBACK_INTERFACE "'>"
+  "    <method name='Callback'>"
+  "      <arg type='s' name='uri' direction='in'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static gboolean opt_list = FALSE;
+static gboolean opt_status = FALSE;
+static char *opt_login_password = NULL;
+static char *opt_import = NULL;
+static gboolean opt_daemon = FALSE;
+static int opt_idle_timeout = BISHO_DAEMON_DEFAULT_TIMEOUT;
+
+static const GOptionEntry options[] = {
+  { "list", 0, 0, G_OPTION_ARG_NONE, &opt_list,
+    N_("List the available services"), NULL },
+  { "status", 0, 0, G_OPTION_ARG_NONE, &opt_status,
+    N_("Show whether each service is logged in"), NULL },
+  { "login-password", 0, 0, G_OPTION_ARG_STRING, &opt_login_password,
+    N_("Log in to SERVICE with the user name and password on standard input"), N_("SERVICE") },
+  { "import", 0, 0, G_OPTION_ARG_FILENAME, &opt_import,
+    N_("Store the credentials of the services listed in FILE"), N_("FILE") },
+  { "daemon", 0, 0, G_OPTION_ARG_NONE, &opt_daemon,
+    N_("Serve the account states on the session bus"), NULL },
+  { "idle-timeout", 0, 0, G_OPTION_ARG_INT, &opt_idle_timeout,
+    N_("Exit the daemon after SECONDS without a call, or never if 0"), N_("SECONDS") },
+  { NULL }
+};
+
 static void
 handle_uri (BishoWindow *window, const char *s)
 {
@@ -35,6 +75,9 @@ handle_uri (BishoWindow *window, const char *s)
   GHashTable *params = NULL;
 
   uri = soup_uri_new (s);
+  if (uri == NULL)
+    return;
+
   if (strcmp (uri->scheme, "x-bisho") != 0) {
     soup_uri_free (uri);
     return;
@@ -81,11 +124,103 @@ unique_message_cb (UniqueApp *app,
   return UNIQUE_RESPONSE_OK;
 }
 
+static void
+callback_method_cb (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+  GtkWindow *window = GTK_WINDOW (user_data);
+  const char *uri;
+
+  g_variant_get (parameters, "(&s)", &uri);
+
+  gtk_window_present (window);
+  handle_uri (BISHO_WINDOW (window), uri);
+
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static const GDBusInterfaceVTable callback_vtable = {
+  callback_method_cb,
+  NULL,
+  NULL
+};
+
+static void
+callback_bus_acquired_cb (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+  GDBusNodeInfo *info;
+  GError *error = NULL;
+
+  info = g_dbus_node_info_new_for_xml (callback_xml, NULL);
+  g_assert (info);
+
+  if (!g_dbus_connection_register_object (connection, CALLBACK_PATH,
+                                          info->interfaces[0], &callback_vtable,
+                                          user_data, NULL, &error)) {
+    g_message ("Cannot register %s: %s", CALLBACK_PATH, error->message);
+    g_error_free (error);
+  }
+
+  g_dbus_node_info_unref (info);
+}
+
+/*
+ * Hand @uri to the running window, if there is one.  This only needs the
+ * session bus, so it is done before GTK is initialised.
+ */
+static gboolean
+forward_callback (const char *uri)
+{
+  GDBusConnection *connection;
+  GVariant *reply;
+
+  bisho_trace_begin ("forward_callback", NULL);
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+  if (connection == NULL) {
+    bisho_trace_end ("forward_callback", NULL);
+    return FALSE;
+  }
+
+  reply = g_dbus_connection_call_sync (connection, CALLBACK_NAME, CALLBACK_PATH,
+                                       CALLBACK_INTERFACE, "Callback",
+                                       g_variant_new ("(s)", uri), NULL,
+                                       G_DBUS_CALL_FLAGS_NO_AUTO_START, 5000,
+                                       NULL, NULL);
+  g_object_unref (connection);
+
+  bisho_trace_end ("forward_callback", NULL);
+
+  if (reply == NULL)
+    return FALSE;
+
+  g_variant_unref (reply);
+  return TRUE;
+}
+
+/* Mark when the window is first drawn, for measuring startup */
+static gboolean
+first_expose_cb (GtkWidget *widget, GdkEventExpose *event, gpointer user_data)
+{
+  bisho_trace_instant ("first_paint", NULL);
+  g_signal_handlers_disconnect_by_func (widget, first_expose_cb, user_data);
+  return FALSE;
+}
+
 int
 main (int argc, char **argv)
 {
   UniqueApp *app;
   GtkWidget *window;
+  GOptionContext *context;
+  GError *error = NULL;
+  guint callback_id;
 
   g_thread_init (NULL);
 
@@ -93,13 +228,47 @@ main (int argc, char **argv)
   bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
   textdomain (GETTEXT_PACKAGE);
 
-  gtk_init (&argc, &argv);
+  /* Parse the headless options before touching the display.  Anything else is
+     left for GTK and the callback URI. */
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, GETTEXT_PACKAGE);
+  g_option_context_set_ignore_unknown_options (context, TRUE);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
 
-  /* TODO: use GOption to parse arguments */
+  /* gtk_init() isn't called in the headless modes */
+  g_type_init ();
 
+  if (opt_list)
+    return bisho_cli_list ();
+  if (opt_status)
+    return bisho_cli_status ();
+  if (opt_login_password)
+    return bisho_cli_login_password (opt_login_password);
+  if (opt_import)
+    return bisho_cli_import (opt_import);
+  if (opt_daemon)
+    return bisho_daemon_run (MAX (opt_idle_timeout, 0));
+
+  /* The browser runs us for every callback, so relay it without any toolkit
+     startup if a window is already open */
+  if (argc == 2 && g_str_has_prefix (argv[1], "x-bisho:") && forward_callback (argv[1]))
+    return 0;
+
+  bisho_trace_begin ("gtk_init", NULL);
+  gtk_init (&argc, &argv);
+  bisho_trace_end ("gtk_init", NULL);
+
+  bisho_trace_begin ("unique_app_new_with_commands", NULL);
   app = unique_app_new_with_commands ("com.intel.Bisho", NULL,
                                       "callback", COMMAND_CALLBACK,
                                       NULL);
+  bisho_trace_end ("unique_app_new_with_commands", NULL);
 
   if (unique_app_is_running (app)) {
     UniqueResponse response;
@@ -124,12 +293,21 @@ main (int argc, char **argv)
 
   g_signal_connect (app, "message-received", G_CALLBACK (unique_message_cb), window);
 
+  callback_id = g_bus_own_name (G_BUS_TYPE_SESSION, CALLBACK_NAME,
+                                G_BUS_NAME_OWNER_FLAGS_NONE,
+                                callback_bus_acquired_cb, NULL, NULL,
+                                window, NULL);
+
   g_signal_connect (window, "delete-event", gtk_main_quit, NULL);
+  if (bisho_trace_enabled ())
+    g_signal_connect_after (window, "expose-event", G_CALLBACK (first_expose_cb), NULL);
 
   gtk_widget_show (window);
 
   gtk_main ();
 
+  g_bus_unown_name (callback_id);
+
  done:
   g_object_unref (app);
 
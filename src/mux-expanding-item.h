@@ -68,6 +68,8 @@ void mux_expanding_item_set_icon_from_name (MuxExpandingItem *item, const char *
 
 void mux_expanding_item_set_icon_from_file (MuxExpandingItem *item, const char *filename);
 
+void mux_expanding_item_set_icon_from_pixbuf (MuxExpandingItem *item, GdkPixbuf *pixbuf);
+
 GtkBox * mux_expanding_item_get_button_box (MuxExpandingItem *item);
 
 GtkBox * mux_expanding_item_get_content_box (MuxExpandingItem *item);
@@ -0,0 +1,622 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A compiled catalog of every service descriptor, so that looking up the
+ * ServiceInfo for the whole service list costs one mmap and no key file
+ * parsing.  The catalog is rebuilt when a service directory or descriptor
+ * changes, or when the locale changes.  This is checked on the first lookup
+ * after the catalog is opened or invalidated, rather than on every lookup.
+ *
+ * The file is a CacheHeader, followed by the CacheDir table, the CacheEntry
+ * table (sorted by service name) and a pool of nul-terminated strings.
+ * Strings are referenced by their offset in the file, with 0 meaning NULL.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "service-cache.h"
+
+#define CACHE_MAGIC "BISHOSVC"
+#define CACHE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  guint32 version;
+  guint32 n_dirs;
+  guint32 n_entries;
+  guint32 locale;
+  guint32 dirs;
+  guint32 entries;
+} CacheHeader;
+
+typedef struct {
+  gint64 mtime;
+  guint32 path;
+  guint32 padding;
+} CacheDir;
+
+enum {
+  FIELD_NAME,
+  FIELD_FILENAME,
+  FIELD_DISPLAY_NAME,
+  FIELD_DESCRIPTION,
+  FIELD_LINK,
+  FIELD_ICON,
+  FIELD_AUTH_TYPE,
+  FIELD_SERVER,
+  FIELD_BASE_URL,
+  FIELD_REQUEST_TOKEN_FUNCTION,
+  FIELD_AUTHORIZE_FUNCTION,
+  FIELD_ACCESS_TOKEN_FUNCTION,
+  FIELD_CALLBACK,
+  N_FIELDS
+};
+
+typedef struct {
+  gint64 mtime;
+  guint32 fields[N_FIELDS];
+  guint32 padding;
+} CacheEntry;
+
+typedef struct {
+  ServiceInfo *info;
+  char *filename;
+  gint64 mtime;
+} BuildEntry;
+
+G_LOCK_DEFINE_STATIC (cache);
+/* The catalog is either mapped from disk, or held in memory if it couldn't be
+   written out */
+static GMappedFile *cache_file = NULL;
+static GByteArray *cache_memory = NULL;
+static const char *cache_data = NULL;
+static gsize cache_length = 0;
+/* Whether the catalog has been checked against the descriptors since it was
+   opened or last invalidated */
+static gboolean cache_validated = FALSE;
+
+char **
+service_cache_get_dirs (void)
+{
+  const char * const *system_dirs;
+  char **dirs;
+  guint i, n;
+
+  system_dirs = g_get_system_data_dirs ();
+  n = g_strv_length ((char **)system_dirs);
+
+  dirs = g_new0 (char *, n + 2);
+  dirs[0] = g_build_filename (g_get_user_data_dir (), "libsocialweb", "services", NULL);
+  for (i = 0; i < n; i++)
+    dirs[i + 1] = g_build_filename (system_dirs[i], "libsocialweb", "services", NULL);
+
+  return dirs;
+}
+
+static int
+compare_names (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(char **)a, *(char **)b);
+}
+
+/*
+ * Make the next lookup check the catalog against the service directories and
+ * descriptors again.  Long-running processes call this before each batch of
+ * lookups, so that changed services are picked up.
+ */
+void
+service_cache_invalidate (void)
+{
+  G_LOCK (cache);
+  cache_validated = FALSE;
+  G_UNLOCK (cache);
+}
+
+/*
+ * Returns the sorted names of every installed service.  A service in more than
+ * one directory is only listed once.
+ */
+char **
+service_cache_list_services (void)
+{
+  GHashTable *seen;
+  GPtrArray *names;
+  char **dirs;
+  int i;
+
+  /* The lookups that follow are a new batch, so check the catalog again */
+  service_cache_invalidate ();
+
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  names = g_ptr_array_new ();
+
+  dirs = service_cache_get_dirs ();
+  for (i = 0; dirs[i]; i++) {
+    GDir *dir;
+    const char *filename;
+
+    dir = g_dir_open (dirs[i], 0, NULL);
+    if (dir == NULL)
+      continue;
+
+    while ((filename = g_dir_read_name (dir)) != NULL) {
+      char *name;
+
+      if (!g_str_has_suffix (filename, ".keys"))
+        continue;
+
+      name = g_strndup (filename, strlen (filename) - strlen (".keys"));
+      if (g_hash_table_lookup (seen, name)) {
+        g_free (name);
+        continue;
+      }
+
+      g_hash_table_insert (seen, name, name);
+      g_ptr_array_add (names, name);
+    }
+
+    g_dir_close (dir);
+  }
+  g_strfreev (dirs);
+
+  g_ptr_array_sort (names, compare_names);
+  g_ptr_array_add (names, NULL);
+
+  g_hash_table_destroy (seen);
+
+  return (char **)g_ptr_array_free (names, FALSE);
+}
+
+static char *
+get_cache_filename (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "bisho", "services.cache", NULL);
+}
+
+static char *
+get_locale (void)
+{
+  return g_strjoinv (":", (char **)g_get_language_names ());
+}
+
+static gint64
+get_mtime (const char *path)
+{
+  struct stat st;
+
+  if (g_stat (path, &st) != 0)
+    return -1;
+
+  return st.st_mtime;
+}
+
+static const char *
+cache_string (guint32 offset)
+{
+  if (offset == 0 || offset >= cache_length)
+    return NULL;
+
+  return cache_data + offset;
+}
+
+static const CacheHeader *
+cache_header (void)
+{
+  return (const CacheHeader *)cache_data;
+}
+
+static void
+cache_clear (void)
+{
+  if (cache_file) {
+    g_mapped_file_unref (cache_file);
+    cache_file = NULL;
+  }
+
+  if (cache_memory) {
+    g_byte_array_free (cache_memory, TRUE);
+    cache_memory = NULL;
+  }
+
+  cache_data = NULL;
+  cache_length = 0;
+  cache_validated = FALSE;
+}
+
+/* Check the structure of the catalog, done once when it is opened */
+static gboolean
+cache_is_sane (void)
+{
+  const CacheHeader *header = cache_header ();
+
+  /* The file always ends with a string, so every string is terminated */
+  if (cache_length < sizeof (CacheHeader) || cache_data[cache_length - 1] != '\0')
+    return FALSE;
+
+  if (memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != CACHE_VERSION)
+    return FALSE;
+
+  if (header->dirs + (gsize)header->n_dirs * sizeof (CacheDir) > cache_length ||
+      header->entries + (gsize)header->n_entries * sizeof (CacheEntry) > cache_length)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Check that the catalog still describes the service directories and descriptors */
+static gboolean
+cache_is_current (void)
+{
+  const CacheHeader *header = cache_header ();
+  const CacheDir *cache_dirs;
+  char **dirs, *locale;
+  gboolean current;
+  guint i;
+
+  locale = get_locale ();
+  current = g_strcmp0 (cache_string (header->locale), locale) == 0;
+  g_free (locale);
+
+  if (!current)
+    return FALSE;
+
+  dirs = service_cache_get_dirs ();
+
+  if (g_strv_length (dirs) != header->n_dirs)
+    current = FALSE;
+
+  cache_dirs = (const CacheDir *)(cache_data + header->dirs);
+  for (i = 0; current && i < header->n_dirs; i++) {
+    current = g_strcmp0 (cache_string (cache_dirs[i].path), dirs[i]) == 0 &&
+      cache_dirs[i].mtime == get_mtime (dirs[i]);
+  }
+
+  g_strfreev (dirs);
+
+  /* Descriptors edited in place don't change the directory mtime */
+  if (current) {
+    const CacheEntry *entries;
+
+    entries = (const CacheEntry *)(cache_data + header->entries);
+    for (i = 0; current && i < header->n_entries; i++)
+      current = entries[i].mtime == get_mtime (cache_string (entries[i].fields[FIELD_FILENAME]));
+  }
+
+  return current;
+}
+
+static guint32
+add_string (GByteArray *array, const char *s)
+{
+  guint32 offset;
+
+  if (s == NULL)
+    return 0;
+
+  offset = array->len;
+  g_byte_array_append (array, (const guint8 *)s, strlen (s) + 1);
+
+  return offset;
+}
+
+static int
+compare_entries (gconstpointer a, gconstpointer b)
+{
+  const BuildEntry *entry_a = *(BuildEntry **)a;
+  const BuildEntry *entry_b = *(BuildEntry **)b;
+
+  return strcmp (entry_a->info->name, entry_b->info->name);
+}
+
+static GByteArray *
+build_cache (void)
+{
+  GByteArray *array;
+  GPtrArray *entries;
+  GHashTable *seen;
+  CacheHeader header;
+  CacheDir *cache_dirs;
+  CacheEntry *cache_entries;
+  char **dirs, *locale;
+  guint i, n_dirs;
+
+  dirs = service_cache_get_dirs ();
+  n_dirs = g_strv_length (dirs);
+  cache_dirs = g_new0 (CacheDir, n_dirs);
+
+  entries = g_ptr_array_new ();
+  seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < n_dirs; i++) {
+    const char *basename;
+    GDir *dir;
+
+    /* Take the mtime first so that changes made while scanning invalidate */
+    cache_dirs[i].mtime = get_mtime (dirs[i]);
+
+    dir = g_dir_open (dirs[i], 0, NULL);
+    if (dir == NULL)
+      continue;
+
+    while ((basename = g_dir_read_name (dir))) {
+      BuildEntry *entry;
+      ServiceInfo *info;
+      char *name, *filename;
+
+      if (!g_str_has_suffix (basename, ".keys"))
+        continue;
+
+      /* The first directory wins, as with g_key_file_load_from_data_dirs() */
+      name = g_strndup (basename, strlen (basename) - strlen (".keys"));
+      if (g_hash_table_lookup (seen, name)) {
+        g_free (name);
+        continue;
+      }
+      g_hash_table_insert (seen, name, GINT_TO_POINTER (TRUE));
+
+      filename = g_build_filename (dirs[i], basename, NULL);
+      info = service_info_new_from_file (name, filename);
+      if (info == NULL) {
+        g_free (filename);
+        continue;
+      }
+
+      entry = g_slice_new (BuildEntry);
+      entry->info = info;
+      entry->filename = filename;
+      entry->mtime = get_mtime (filename);
+      g_ptr_array_add (entries, entry);
+    }
+
+    g_dir_close (dir);
+  }
+
+  g_hash_table_destroy (seen);
+
+  g_ptr_array_sort (entries, compare_entries);
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CACHE_MAGIC, sizeof (header.magic));
+  header.version = CACHE_VERSION;
+  header.n_dirs = n_dirs;
+  header.n_entries = entries->len;
+  header.dirs = sizeof (CacheHeader);
+  header.entries = header.dirs + n_dirs * sizeof (CacheDir);
+
+  /* Reserve space for the tables, which are copied in once the string pool
+     has been written */
+  array = g_byte_array_new ();
+  g_byte_array_set_size (array, header.entries + entries->len * sizeof (CacheEntry));
+  memset (array->data, 0, array->len);
+
+  for (i = 0; i < n_dirs; i++)
+    cache_dirs[i].path = add_string (array, dirs[i]);
+
+  cache_entries = g_new0 (CacheEntry, entries->len);
+
+  for (i = 0; i < entries->len; i++) {
+    BuildEntry *entry = g_ptr_array_index (entries, i);
+    ServiceInfo *info = entry->info;
+    guint32 *fields = cache_entries[i].fields;
+
+    cache_entries[i].mtime = entry->mtime;
+
+    fields[FIELD_NAME] = add_string (array, info->name);
+    fields[FIELD_FILENAME] = add_string (array, entry->filename);
+    fields[FIELD_DISPLAY_NAME] = add_string (array, info->display_name);
+    fields[FIELD_DESCRIPTION] = add_string (array, info->description);
+    fields[FIELD_LINK] = add_string (array, info->link);
+    fields[FIELD_ICON] = add_string (array, info->icon);
+    fields[FIELD_AUTH_TYPE] = add_string (array, info->auth_type);
+
+    if (g_str_equal (info->auth_type, "username") ||
+        g_str_equal (info->auth_type, "password")) {
+      fields[FIELD_SERVER] = add_string (array, info->auth.password.server);
+    } else if (g_str_equal (info->auth_type, "oauth")) {
+      fields[FIELD_BASE_URL] = add_string (array, info->auth.oauth.base_url);
+      fields[FIELD_REQUEST_TOKEN_FUNCTION] = add_string (array, info->auth.oauth.request_token_function);
+      fields[FIELD_AUTHORIZE_FUNCTION] = add_string (array, info->auth.oauth.authorize_function);
+      fields[FIELD_ACCESS_TOKEN_FUNCTION] = add_string (array, info->auth.oauth.access_token_function);
+      fields[FIELD_CALLBACK] = add_string (array, info->auth.oauth.callback);
+    }
+
+    service_info_unref (entry->info);
+    g_free (entry->filename);
+    g_slice_free (BuildEntry, entry);
+  }
+
+  /* Written last, so the file always ends in a nul */
+  locale = get_locale ();
+  header.locale = add_string (array, locale);
+  g_free (locale);
+
+  memcpy (array->data, &header, sizeof (header));
+  memcpy (array->data + header.dirs, cache_dirs, n_dirs * sizeof (CacheDir));
+  memcpy (array->data + header.entries, cache_entries, entries->len * sizeof (CacheEntry));
+
+  g_free (cache_entries);
+  g_free (cache_dirs);
+  g_ptr_array_free (entries, TRUE);
+  g_strfreev (dirs);
+
+  return array;
+}
+
+static void
+cache_rebuild (void)
+{
+  GByteArray *array;
+  GError *error = NULL;
+  char *filename, *dirname;
+
+  cache_clear ();
+
+  array = build_cache ();
+
+  filename = get_cache_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (g_file_set_contents (filename, (char *)array->data, array->len, &error)) {
+    cache_file = g_mapped_file_new (filename, FALSE, NULL);
+  } else {
+    g_message ("Cannot write service cache: %s", error->message);
+    g_error_free (error);
+  }
+
+  g_free (filename);
+
+  if (cache_file) {
+    g_byte_array_free (array, TRUE);
+    cache_data = g_mapped_file_get_contents (cache_file);
+    cache_length = g_mapped_file_get_length (cache_file);
+  } else {
+    cache_memory = array;
+    cache_data = (const char *)array->data;
+    cache_length = array->len;
+  }
+}
+
+/* Must be called with the cache lock held */
+static gboolean
+cache_ensure (void)
+{
+  if (cache_data && cache_validated)
+    return TRUE;
+
+  if (cache_data == NULL) {
+    char *filename;
+
+    filename = get_cache_filename ();
+    cache_file = g_mapped_file_new (filename, FALSE, NULL);
+    g_free (filename);
+
+    if (cache_file) {
+      cache_data = g_mapped_file_get_contents (cache_file);
+      cache_length = g_mapped_file_get_length (cache_file);
+      if (!cache_is_sane ())
+        cache_clear ();
+    }
+  }
+
+  if (cache_data == NULL || !cache_is_current ())
+    cache_rebuild ();
+
+  if (cache_data == NULL || !cache_is_sane ())
+    return FALSE;
+
+  cache_validated = TRUE;
+
+  return TRUE;
+}
+
+static const CacheEntry *
+cache_find_entry (const char *name)
+{
+  const CacheHeader *header = cache_header ();
+  const CacheEntry *entries;
+  int low, high;
+
+  entries = (const CacheEntry *)(cache_data + header->entries);
+  low = 0;
+  high = (int)header->n_entries - 1;
+
+  while (low <= high) {
+    int mid, cmp;
+
+    mid = (low + high) / 2;
+    cmp = g_strcmp0 (name, cache_string (entries[mid].fields[FIELD_NAME]));
+
+    if (cmp == 0)
+      return &entries[mid];
+    else if (cmp < 0)
+      high = mid - 1;
+    else
+      low = mid + 1;
+  }
+
+  return NULL;
+}
+
+static ServiceInfo *
+info_from_entry (const CacheEntry *entry)
+{
+  ServiceInfo *info;
+
+#define FIELD(f) g_strdup (cache_string (entry->fields[f]))
+  info = service_info_new (cache_string (entry->fields[FIELD_NAME]),
+                           cache_string (entry->fields[FIELD_AUTH_TYPE]));
+  info->display_name = FIELD (FIELD_DISPLAY_NAME);
+  info->description = FIELD (FIELD_DESCRIPTION);
+  info->link = FIELD (FIELD_LINK);
+  info->icon = FIELD (FIELD_ICON);
+
+  if (g_strcmp0 (info->auth_type, "username") == 0 ||
+      g_strcmp0 (info->auth_type, "password") == 0) {
+    info->auth.password.server = FIELD (FIELD_SERVER);
+  } else if (g_strcmp0 (info->auth_type, "oauth") == 0) {
+    info->auth.oauth.base_url = FIELD (FIELD_BASE_URL);
+    info->auth.oauth.request_token_function = FIELD (FIELD_REQUEST_TOKEN_FUNCTION);
+    info->auth.oauth.authorize_function = FIELD (FIELD_AUTHORIZE_FUNCTION);
+    info->auth.oauth.access_token_function = FIELD (FIELD_ACCESS_TOKEN_FUNCTION);
+    info->auth.oauth.callback = FIELD (FIELD_CALLBACK);
+  }
+#undef FIELD
+
+  return info;
+}
+
+/*
+ * Look up @name in the service cache.  Returns TRUE if the cache could be
+ * used, in which case *info is set to the service information or NULL if there
+ * is no such service.  Returns FALSE if the caller should read the descriptor
+ * itself.
+ */
+gboolean
+service_cache_lookup (const char *name, ServiceInfo **info)
+{
+  const CacheEntry *entry;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (name, FALSE);
+  g_return_val_if_fail (info, FALSE);
+
+  *info = NULL;
+
+  G_LOCK (cache);
+
+  if (!cache_ensure ())
+    goto done;
+
+  entry = cache_find_entry (name);
+  if (entry)
+    *info = info_from_entry (entry);
+
+  ret = TRUE;
+
+ done:
+  G_UNLOCK (cache);
+
+  return ret;
+}
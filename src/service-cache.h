@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2010 Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SERVICE_CACHE_H
+#define _SERVICE_CACHE_H
+
+#include <glib.h>
+#include "service-info.h"
+
+char ** service_cache_get_dirs (void);
+
+void service_cache_invalidate (void);
+
+char ** service_cache_list_services (void);
+
+gboolean service_cache_lookup (const char *name, ServiceInfo **info);
+
+#endif /* _SERVICE_CACHE_H */
@@ -20,30 +20,44 @@
 #include <glib.h>
 #include <libsocialweb-keystore/sw-keystore.h>
 #include "service-info.h"
+#include "service-cache.h"
 
 #define GROUP "LibSocialWebService"
+#define GROUP_OAUTH "OAuth"
 
+/*
+ * Create an empty ServiceInfo for @name with @auth_type, for the loaders to
+ * fill in.
+ */
 ServiceInfo *
-get_info_for_service (const char *name)
+service_info_new (const char *name, const char *auth_type)
+{
+  ServiceInfo *info;
+
+  info = g_slice_new0 (ServiceInfo);
+  info->ref_count = 1;
+  info->name = g_intern_string (name);
+  info->auth_type = g_intern_string (auth_type);
+
+  return info;
+}
+
+ServiceInfo *
+service_info_new_from_file (const char *name, const char *filename)
 {
-  char *filename, *path, *real_path;
+  char *path, *icon_name, *auth_type;
   GKeyFile *keys;
   ServiceInfo *info;
 
   g_assert (name);
-
-  filename = g_strconcat (name, ".keys", NULL);
-  path = g_build_filename ("libsocialweb", "services", filename, NULL);
-  g_free (filename);
+  g_assert (filename);
 
   keys = g_key_file_new ();
 
-  if (!g_key_file_load_from_data_dirs (keys, path, &real_path, G_KEY_FILE_NONE, NULL)) {
-    g_free (path);
+  if (!g_key_file_load_from_file (keys, filename, G_KEY_FILE_NONE, NULL)) {
     g_key_file_free (keys);
     return NULL;
   }
-  g_free (path);
 
   /* Sanity check for required keys */
   if (!g_key_file_has_key (keys, GROUP, "Name", NULL) ||
@@ -52,26 +66,34 @@ get_info_for_service (const char *name)
     return NULL;
   }
 
-  info = g_slice_new0 (ServiceInfo);
-  info->keys = keys;
+  auth_type = g_key_file_get_string (keys, GROUP, "AuthType", NULL);
+  info = service_info_new (name, auth_type);
+  g_free (auth_type);
 
-  info->name = g_strdup (name);
   info->display_name = g_key_file_get_locale_string (keys, GROUP, "Name", NULL, NULL);
   info->description = g_key_file_get_locale_string (keys, GROUP, "Description", NULL, NULL);
   info->link = g_key_file_get_string (keys, GROUP, "Link", NULL);
-  info->auth_type = g_key_file_get_string (keys, GROUP, "AuthType", NULL);
 
   if (g_str_equal (info->auth_type, "username") ||
       g_str_equal (info->auth_type, "password")) {
     info->auth.password.server = g_key_file_get_string (keys, GROUP, "AuthPasswordServer", NULL);
+  } else if (g_str_equal (info->auth_type, "oauth")) {
+    info->auth.oauth.base_url = g_key_file_get_string (keys, GROUP_OAUTH, "BaseURL", NULL);
+    info->auth.oauth.request_token_function = g_key_file_get_string (keys, GROUP_OAUTH, "RequestTokenFunction", NULL);
+    info->auth.oauth.authorize_function = g_key_file_get_string (keys, GROUP_OAUTH, "AuthoriseFunction", NULL);
+    info->auth.oauth.access_token_function = g_key_file_get_string (keys, GROUP_OAUTH, "AccessTokenFunction", NULL);
+    info->auth.oauth.callback = g_key_file_get_string (keys, GROUP_OAUTH, "Callback", NULL);
   }
 
+  /* Everything needed has been extracted */
+  g_key_file_free (keys);
+
   /* TODO: this should be specified in the key file or something */
-  path = g_path_get_dirname (real_path);
-  g_free (real_path);
-  filename = g_strconcat (name, ".png", NULL);
-  info->icon = g_build_filename (path, filename, NULL);
-  g_free (filename);
+  path = g_path_get_dirname (filename);
+  icon_name = g_strconcat (name, ".png", NULL);
+  info->icon = g_build_filename (path, icon_name, NULL);
+  g_free (icon_name);
+  g_free (path);
 
   if (!g_file_test (info->icon, G_FILE_TEST_EXISTS)) {
     g_free (info->icon);
@@ -81,3 +103,74 @@ get_info_for_service (const char *name)
   return info;
 }
 
+ServiceInfo *
+service_info_ref (ServiceInfo *info)
+{
+  g_return_val_if_fail (info, NULL);
+
+  g_atomic_int_inc (&info->ref_count);
+
+  return info;
+}
+
+void
+service_info_unref (ServiceInfo *info)
+{
+  if (info == NULL)
+    return;
+
+  if (!g_atomic_int_dec_and_test (&info->ref_count))
+    return;
+
+  g_free (info->display_name);
+  g_free (info->description);
+  g_free (info->link);
+  g_free (info->icon);
+
+  if (g_strcmp0 (info->auth_type, "username") == 0 ||
+      g_strcmp0 (info->auth_type, "password") == 0) {
+    g_free (info->auth.password.server);
+  } else if (g_strcmp0 (info->auth_type, "oauth") == 0) {
+    g_free (info->auth.oauth.base_url);
+    g_free (info->auth.oauth.request_token_function);
+    g_free (info->auth.oauth.authorize_function);
+    g_free (info->auth.oauth.access_token_function);
+    g_free (info->auth.oauth.callback);
+  }
+
+  g_slice_free (ServiceInfo, info);
+}
+
+ServiceInfo *
+get_info_for_service (const char *name)
+{
+  char **dirs, *filename;
+  ServiceInfo *info = NULL;
+  int i;
+
+  g_assert (name);
+
+  /* The service cache is authoritative if it could be opened */
+  if (service_cache_lookup (name, &info))
+    return info;
+
+  filename = g_strconcat (name, ".keys", NULL);
+  dirs = service_cache_get_dirs ();
+
+  for (i = 0; dirs[i]; i++) {
+    char *path;
+
+    path = g_build_filename (dirs[i], filename, NULL);
+    if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+      info = service_info_new_from_file (name, path);
+      g_free (path);
+      break;
+    }
+    g_free (path);
+  }
+
+  g_strfreev (dirs);
+  g_free (filename);
+
+  return info;
+}
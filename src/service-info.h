@@ -22,21 +22,40 @@
 
 #include <glib.h>
 
+/*
+ * Everything needed about a service, extracted when it is loaded.  The name
+ * and auth type are interned so can be compared by pointer.
+ */
 typedef struct {
-  char *name;
+  int ref_count;
+  const char *name;
   char *display_name;
   char *description;
   char *link;
   char *icon;
-  char *auth_type;
+  const char *auth_type;
   union {
     struct {
       char *server;
     } password;
+    struct {
+      char *base_url;
+      char *request_token_function;
+      char *authorize_function;
+      char *access_token_function;
+      char *callback;
+    } oauth;
   } auth;
-  GKeyFile *keys;
 } ServiceInfo;
 
 ServiceInfo * get_info_for_service (const char *name);
 
+ServiceInfo * service_info_new (const char *name, const char *auth_type);
+
+ServiceInfo * service_info_new_from_file (const char *name, const char *filename);
+
+ServiceInfo * service_info_ref (ServiceInfo *info);
+
+void service_info_unref (ServiceInfo *info);
+
 #endif /* _SERVICE_INFO_H */